@@ -15,9 +15,13 @@
 #include <type_traits>
 #include <algorithm>
 #include <fstream>
+#include <stdexcept>
 #include "board.h"
+#include "bitboard.h"
 #include "action.h"
 #include "weight.h"
+#include "ntuple.h"
+#include "expectimax.h"
 #include <vector>
 #include <algorithm>
 using namespace std;
@@ -65,6 +69,11 @@ public:
 	}
 	virtual ~random_agent() {}
 
+	/**
+	 * restart the random engine, e.g., so that the moves of a game do not depend on the earlier games
+	 */
+	void seed(unsigned s) { engine.seed(s); }
+
 protected:
 	std::default_random_engine engine;
 };
@@ -75,14 +84,14 @@ protected:
 class weight_agent : public agent {
 public:
 	weight_agent(const std::string& args = "") : agent(args), alpha(0.1/32), lambda(0), trained(0) {
-		if (meta.find("init") != meta.end())
-			init_weights(meta["init"]);
-		if (meta.find("load") != meta.end())
-			load_weights(meta["load"]);
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]); 
 		if (meta.find("lambda") != meta.end())
 			lambda = float(meta["lambda"]); 
+		if (meta.find("init") != meta.end())
+			init_weights(meta["init"]);
+		if (meta.find("load") != meta.end())
+			load_weights(meta["load"]);
 		if (meta.find("seed") != meta.end())
 			engine.seed(int(meta["seed"]));
 	}
@@ -92,15 +101,44 @@ public:
 		}
 	}
 
+public:
+	/**
+	 * share the weight tables of another agent, e.g., for training in parallel threads
+	 * updates are then visible to both agents, and are applied without locking (Hogwild!-style)
+	 */
+	void share_weights(const weight_agent& master) {
+		net = master.net;
+	}
+
 protected:
 	virtual void init_weights(const std::string& info) {
 		std::string res = info; // comma-separated sizes, e.g., "65536,65536"
 		for (char& ch : res)
 			if (!std::isdigit(ch)) ch = ' ';
 		std::stringstream in(res);
+		if (meta.find("mmap") != meta.end() && meta.find("save") != meta.end()) {
+			// train directly on a mapped file, so that saving is just a msync
+			std::vector<size_t> sizes;
+			for (size_t size; in >> size; sizes.push_back(size));
+			mapped = weight_file::create(meta["save"], sizes);
+			if (!mapped) std::exit(-1);
+			net = mapped->tables();
+			return;
+		}
 		for (size_t size; in >> size; net.emplace_back(size));
 	}
 	virtual void load_weights(const std::string& path) {
+		if (meta.find("mmap") != meta.end()) {
+			// evaluation maps the file read-only so that the pages are shared between processes,
+			// while training writes back to the file only if it is also the save path
+			weight_file::mode how = weight_file::copy_on_write;
+			if (alpha == 0) how = weight_file::readonly;
+			else if (meta.find("save") != meta.end() && std::string(meta["save"]) == path) how = weight_file::write_back;
+			mapped = weight_file::open(path, how);
+			if (!mapped) std::exit(-1);
+			net = mapped->tables();
+			return;
+		}
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open()) std::exit(-1);
 		uint32_t size;
@@ -110,6 +148,10 @@ protected:
 		in.close();
 	}
 	virtual void save_weights(const std::string& path) {
+		if (mapped && mapped->path() == path) { // the mapped file is already up to date, or is synced here
+			if (mapped->access() == weight_file::write_back && !mapped->sync()) std::exit(-1);
+			return;
+		}
 		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
 		if (!out.is_open()) std::exit(-1);
 		uint32_t size = net.size();
@@ -120,6 +162,7 @@ protected:
 
 protected:
 	std::vector<weight> net;
+	std::shared_ptr<weight_file> mapped;
 	float alpha;
 	float lambda;
 	int trained;
@@ -176,7 +219,7 @@ public:
 	virtual action take_action(const board& before) {
 		std::shuffle(opcode.begin(), opcode.end(), engine);
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
+			board::reward reward = bitboard(before).slide(op);
 			if (reward != -1) return action::slide(op);
 		}
 		return action();
@@ -195,7 +238,7 @@ public:
 		board::reward best_reward = -1;
 		int best_op = 0;
 	        for (int op : opcode) {
-	                board::reward reward = board(before).slide(op);
+	                board::reward reward = bitboard(before).slide(op);
 			if(reward > best_reward){
 				best_reward = reward;
 				best_op = op;
@@ -216,11 +259,11 @@ public:
 		board::reward best_reward = -1;
 		int best_op = 0;
 		for (int op : opcode) {
-			board board1 = board(before);
+			bitboard board1 = bitboard(before);
 			board::reward reward1 = board1.slide(op);
 			if(reward1 != -1){
 				for (int op2 : opcode) {
-					board board2 = board(board1);
+					bitboard board2 = bitboard(board1);
 					board::reward reward2 = board2.slide(op2);
 					if(reward1+reward2 > best_reward){
 						best_reward = reward1+reward2;
@@ -235,21 +278,60 @@ public:
 private:
 	std::array<int, 4> opcode;
 };	
-int n=4;
-int tup[4][6] = { {0, 1, 2, 3, 4, 5},
-                    {4, 5, 6, 7, 8, 9},
-                    {5, 6, 7, 9, 10, 11},
-                    {9, 10, 11, 13, 14, 15}};
-int margin[4][4] = { {12, 13, 14, 15},
-						{0, 4, 8, 12},
-						{0, 1, 2, 3},
-						{3, 7, 11, 15} };
-
 class weight_slider : public weight_agent {
 public:
-	weight_slider(const std::string& args = "") : weight_agent("name=slide role=slider " + args) {}
+	/**
+	 * a slider with its own weights (by init or load), or with the weights of the master if it is given,
+	 * e.g., for the workers training one network; the weights must fit the network selected by tuple
+	 */
+	weight_slider(const std::string& args = "", const weight_slider* master = nullptr) : weight_agent("name=slide role=slider " + args),
+		estimate(ntuple_4x6::estimate), adjust(ntuple_4x6::update), estimate_batch(ntuple_4x6::estimate_batch), depth(2), budget(0),
+		search(meta.find("tt") != meta.end() ? unsigned(meta["tt"]) : 16) {
+		if (meta.find("time") != meta.end()) // milliseconds per move
+			budget = uint64_t(double(meta["time"]) * 1000);
+		if (meta.find("speed") != meta.end()) // moves per second
+			budget = std::min(budget ?: uint64_t(-1), uint64_t(1000000 / double(meta["speed"])));
+		if (budget) // deepen until the time is up
+			depth = 15;
+		if (meta.find("depth") != meta.end())
+			depth = std::max(unsigned(meta["depth"]), 1u);
+		std::string tuple = meta.find("tuple") != meta.end() ? meta["tuple"] : std::string("4x6");
+		meta["tuple"] = { tuple };
+		bool simd = meta.find("simd") == meta.end() || std::string(meta["simd"]) != "0";
+		if (tuple == "8x4") {
+			estimate = ntuple_8x4::estimate;
+			adjust = ntuple_8x4::update;
+			estimate_batch = ntuple_8x4::estimate_batch;
+		} else if (tuple != "4x6") {
+			throw std::invalid_argument("invalid tuple: " + tuple);
+		} else if (simd && ntuple_4x6::simd()) {
+			estimate = ntuple_4x6::estimate_simd;
+			adjust = ntuple_4x6::update_simd;
+			estimate_batch = ntuple_4x6::estimate_batch_simd;
+		}
+		if (master) share_weights(*master);
+		sizes = (tuple == "8x4") ? ntuple_8x4::sizes() : ntuple_4x6::sizes();
+		if (net.size()) check_weights(); // otherwise checked before playing, as the statistics may only be loaded
+	}
+
+	/**
+	 * throw if the weights do not fit the selected network, i.e., the number of tables or any of their lengths
+	 */
+	void check_weights() const {
+		bool fit = net.size() == sizes.size();
+		for (size_t f = 0; fit && f < sizes.size(); f++) fit = net[f].size() >= sizes[f];
+		if (fit) return;
+		std::stringstream need;
+		for (size_t f = 0; f < sizes.size(); f++) need << (f ? "," : "") << sizes[f];
+		throw std::invalid_argument("invalid weights for tuple=" + property("tuple") + ": " + std::to_string(net.size())
+		                            + " tables are given by init or load, while " + std::to_string(sizes.size())
+		                            + " tables of " + need.str() + " entries are needed");
+	}
+
 	virtual void open_episode(const std::string& flag = "") {
+        if (net.empty()) check_weights();
         trained = 0;
+        searched = {};
     }
 	virtual action take_action(const board& before) {
 		
@@ -282,60 +364,16 @@ public:
 		
 	}	
 	int expectimax(const board& before){
-		int final_bestop = -1;
-		double final_bestval = -1e15;
-		int bestop2[4] = {-1,-1,-1,-1};
-		for(int op=0;op<4;op++){
-			board board1 = board(before);
-			board::reward reward1 = board1.slide(op);
-			
-			int poscount=4;
-			double valcount=0;
-			for(int i=0;i<4;i++){
-				board board2 = board(board1);
-				int p = margin[op][i];
-				//generate random hint
-				int bag[3], num = 0;
-				for (board::cell t = 1; t <= 3; t++)
-					for (size_t it = 0; it < board2.bag(t); it++)
-						bag[num++] = t;
-				std::shuffle(bag, bag + num, engine);
-				board::cell hint = bag[--num];
-				int val = board2.place(p, board2.hint(), hint);
-				if(val<0){
-					poscount--;
-					continue;
-				}
-				double bestval=-10000000;
-				for(int op2=0;op2<4;op2++){
-					board board3 = board(board2);
-					board::reward reward2 = board3.slide(op2);
-					// choose the best operation base on current weight table.
-					if(reward2 != -1){
-						double value = get_value(board3);
-						if(reward2+value>bestval){
-							bestval = reward2+value;
-							bestop2[op] = op2;
-						}
-					}
-				}
-				if (bestval > -10000000) valcount += bestval;
-				//else poscount--;
-			}
-			
-			double opvalue=0;
-			if(poscount!=0){
-				opvalue = reward1 + valcount / poscount;
-				//cout << opvalue << endl;
-			}
-			//double opvalue = reward1 + get_value(board1) + Expectimax(board1, op, 1);
-			if(reward1 != -1){
-
-				if(opvalue > final_bestval){
-					final_bestval = opvalue;
-					final_bestop = op;
-				}
-			}
+		auto start = ::expectimax::clock::now();
+		size_t nodes = search.nodes();
+		unsigned reached = depth;
+		int final_bestop = budget ? search.deepen(before, depth, budget, net, estimate, &reached)
+		                          : search.search(before, depth, net, estimate);
+		if(final_bestop!=-1){
+			searched.moves += 1;
+			searched.depth += reached;
+			searched.nodes += search.nodes() - nodes;
+			searched.usec += std::chrono::duration_cast<std::chrono::microseconds>(::expectimax::clock::now() - start).count();
 		}
 		next = before;
 		board::reward nextreward = next.slide(final_bestop);
@@ -343,55 +381,122 @@ public:
 		trained += 1;
 		if(lambda!=0){
 			nextnext = next;
-			board::reward nextreward2 = nextnext.slide(bestop2[final_bestop]);
+			board::reward nextreward2 = nextnext.slide(search.search(next, 1, net, estimate));
 			if(trained>=2) TD2step(nextreward,nextreward2); // if not the first step
 			trained += 1;
 		}
 		return final_bestop;
 	}
 	
-	double get_value(board& b){
-		double value=0;
-		//for 8*4 tuple
-		/*
-		for(int i=0;i<n;i++){
-			value += net[i][b2feature(b,i];
-		}*/
+	/**
+	 * the statistics of the searches in the current episode
+	 */
+	const search_stats& search_info() const {
+		return searched;
+	}
+
+	/**
+	 * whether the slides depend on the before state only and are searched by at most 2 plies,
+	 * i.e., depth=1 or depth=2 without learning and time budget, so that take_actions chooses the same slides as take_action
+	 */
+	bool batchable() const {
+		return alpha == 0 && budget == 0 && depth <= 2;
+	}
 
-		//for 4*6 tuple
-		for(int i=0;i<2;i++){
-			for(int j=0;j<4;j++){
-				for(int f=0;f<n;f++){
-					value += net[f][b2feature(b,f)];
+	/**
+	 * choose the slides (or -1) of a batch of before states by the expectimax of depth 1 or 2 without learning,
+	 * and add the statistics of each search to searched (if given), except the time, which is shared
+	 * by the batch and is left to the caller
+	 * the leaves of the whole batch are packed into an array first, i.e., the afterstates of the slides,
+	 * or with depth=2, the afterstates of the slides after every placement of the chance layer,
+	 * and are then evaluated together so that their cache misses overlap
+	 */
+	void take_actions(const bitboard* before, int* ops, size_t n, search_stats* searched = nullptr) {
+		if (net.empty()) check_weights();
+		after_state.clear();
+		after_reward.resize(4 * n);
+		leaf_reward.clear();
+		chance.clear();
+		for (size_t i = 0; i < n; i++) {
+			for (int op = 0; op < 4; op++) {
+				bitboard after = before[i];
+				after_reward[i * 4 + op] = after.slide(op);
+				if (after_reward[i * 4 + op] == -1) continue; // illegal
+				unsigned empty = 0, total = after.bag(1) + after.bag(2) + after.bag(3);
+				const unsigned* margin = ::expectimax::margins()[after.last() & 0b11];
+				if (depth > 1) for (int k = 0; k < 4; k++) empty += (after(margin[k]) == 0);
+				chance.push_back({ total ? empty : 0, total });
+				if (chance.back().empty == 0) { // evaluated as a leaf, as expectimax does at the last ply or a full margin
+					after_state.push_back(after);
+					continue;
 				}
-				b.rotate_clockwise();
+				for (int k = 0; k < 4; k++) { // the same placements as expectimax, where any next hint tile will do
+					if (after(margin[k]) != 0) continue;
+					bitboard place = after;
+					place.place(margin[k], after.hint(), after.bag(1) ? 1 : after.bag(2) ? 2 : 3);
+					for (int next = 0; next < 4; next++) {
+						bitboard leaf = place;
+						leaf_reward.push_back(leaf.slide(next));
+						if (leaf_reward.back() != -1) after_state.push_back(leaf);
+					}
+				}
+			}
+		}
+		after_value.resize(after_state.size());
+		estimate_batch(net, after_state.data(), after_value.data(), after_state.size());
+		const double* value = after_value.data();
+		const board::reward* reward2 = leaf_reward.data();
+		const chance_info* node = chance.data();
+		for (size_t i = 0; i < n; i++) {
+			ops[i] = -1;
+			double best = 0;
+			size_t nodes = 1;
+			for (int op = 0; op < 4; op++) { // the same order, summation, and tie-breaking as expectimax
+				board::reward reward = after_reward[i * 4 + op];
+				if (reward == -1) continue; // illegal
+				double expect = 0;
+				if (node->empty == 0) {
+					expect = *(value++);
+				} else {
+					for (unsigned k = 0; k < node->empty; k++) {
+						double best2 = 0;
+						bool found = false;
+						for (int next = 0; next < 4; next++) {
+							board::reward r = *(reward2++);
+							if (r == -1) continue;
+							double v = r + *(value++);
+							if (!found || v > best2) best2 = v, found = true;
+						}
+						expect += best2 * node->total;
+					}
+					expect /= double(node->empty) * node->total;
+				}
+				nodes += (depth > 1) + node->empty;
+				node++;
+				double v = reward + expect;
+				if (ops[i] == -1 || v > best) ops[i] = op, best = v;
+			}
+			if (searched && ops[i] != -1) {
+				searched[i].moves += 1;
+				searched[i].depth += depth;
+				searched[i].nodes += nodes;
 			}
-			b.reflect_vertical();
 		}
-		return value;
+	}
+
+	double get_value(const bitboard& b){
+		return estimate(net, b);
 	}
 
 	void TDlearn(double reward){
+		if(alpha==0) return; // no update, and the weights may be mapped read-only
 		double TDerr;
 		if(reward==-1) TDerr = alpha*(-get_value(prev));
 		else TDerr = alpha*(reward+get_value(next)-get_value(prev));
-		
-		/* for 8*4-tuple
-		for(int i=0;i<n;i++){
-			net[i][b2feature(prev,i)] += TDerr;
-		}*/
-		// for 4*6-tuple
-		for(int i=0;i<2;i++){
-			for(int j=0;j<4;j++){
-				for(int f=0;f<n;f++){
-					net[f][b2feature(prev,f)] += TDerr;
-				}
-				prev.rotate_clockwise();
-			}
-			prev.reflect_vertical();
-		}
+		adjust(net, prev, TDerr);
 	}
 	void TD2step(double reward, double reward2){
+		if(alpha==0) return;
 		double TDerr;
 		if(reward==-1) TDerr = -get_value(prev);
 		else{
@@ -406,35 +511,24 @@ public:
 		} 
 		
 		TDerr *= alpha;
-
-		/* for 8*4-tuple
-		for(int i=0;i<n;i++){
-			net[i][b2feature(prev,i)] += TDerr;
-		}*/
-		// for 4*6-tuple
-		for(int i=0;i<2;i++){
-			for(int j=0;j<4;j++){
-				for(int f=0;f<n;f++){
-					net[f][b2feature(prev,f)] += TDerr;
-				}
-				prev.rotate_clockwise();
-			}
-			prev.reflect_vertical();
-		}
+		adjust(net, prev, TDerr);
 	}
-	long long int  b2feature(board& b,int f){//board to feature
-		long long int ret=0;
-		int weight[6] = {1,15,225,3375,50625,759375};
-		for(int c=0;c<6;c++){
-			int cell_index = tup[f][c];
-			board::cell tmpcell=b(cell_index);
-			ret+=weight[c]*tmpcell;
-		}
-		return ret;
-	}
-
 private:
-	board next;
-	board prev;
-	board nextnext;
+	bitboard next;
+	bitboard prev;
+	bitboard nextnext;
+	double (*estimate)(const std::vector<weight>&, const bitboard&); // the n-tuple network selected by tuple=
+	void (*adjust)(std::vector<weight>&, const bitboard&, double);
+	void (*estimate_batch)(const std::vector<weight>&, const bitboard*, double*, size_t);
+	std::vector<size_t> sizes; // the entries needed by each table of the selected network
+	unsigned depth; // plies of slides searched by expectimax, or the maximum plies if budget is set
+	uint64_t budget; // time budget per move in microseconds, 0 for searching a fixed depth
+	::expectimax search;
+	search_stats searched;
+	struct chance_info { unsigned empty, total; }; // the placements (0 for a leaf) and the tiles in the bag of an afterstate
+	std::vector<bitboard> after_state; // the leaves of a batch, see take_actions
+	std::vector<board::reward> after_reward;
+	std::vector<board::reward> leaf_reward; // the rewards of the slides after each placement
+	std::vector<chance_info> chance;
+	std::vector<double> after_value;
 };	
\ No newline at end of file
@@ -0,0 +1,156 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * batch.h: Batched evaluation of the slider over many games in lockstep
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <chrono>
+#include "board.h"
+#include "bitboard.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistics.h"
+
+/**
+ * play the games of an evaluation in lanes, where each lane plays one game at a time,
+ * and every unfinished lane makes one move per step
+ *
+ * in each step, the placing lanes are served by their own placers, while the before states of
+ * the sliding lanes are packed into an array and are decided together by weight_slider::take_actions
+ *
+ * the placer of a game is seeded by the seed plus the index of the game, so that each game is
+ * independent of the others, and the finished games are committed in the order of their indices;
+ * hence the statistics are the same for any number of lanes
+ *
+ * each lane keeps its own clock, which starts at the wall clock when its game is opened and is then
+ * advanced only by the work of the lane: a placement is timed by itself, and the time of choosing
+ * the slides of a step is split evenly among the sliding lanes; the times of the moves and of the game
+ * are read from this clock in milliseconds, as the sequential path reads them from the wall clock
+ */
+class batch_evaluator {
+public:
+	batch_evaluator(weight_slider& slide, const std::string& place_args, size_t lanes, unsigned seed = 1)
+		: slide(slide), seed(seed), claimed(0), committed(0) {
+		for (size_t i = 0; i < std::max<size_t>(lanes, 1); i++) {
+			places.emplace_back(new random_placer(place_args));
+			games.emplace_back();
+		}
+		playing.assign(places.size(), false);
+		index.assign(places.size(), 0);
+		searched.assign(places.size(), {});
+		now.assign(places.size(), {});
+	}
+
+	/**
+	 * play the episodes claimed from the statistics until no more is needed
+	 */
+	void run(statistics& stats) {
+		for (size_t i = 0; i < games.size(); i++) open(stats, i);
+		std::vector<bitboard> before;
+		std::vector<size_t> sliding;
+		std::vector<int> ops;
+		while (std::find(playing.begin(), playing.end(), true) != playing.end()) {
+			before.clear();
+			sliding.clear();
+			for (size_t i = 0; i < games.size(); i++) {
+				if (!playing[i]) continue;
+				episode& game = games[i];
+				agent& who = game.take_turns(slide, *places[i]);
+				if (&who == &slide) {
+					before.push_back(bitboard(game.state()));
+					sliding.push_back(i);
+					continue;
+				}
+				auto start = clock::now();
+				action move = who.take_action(game.state());
+				if (game.apply_action(move, elapse(i, clock::now() - start)) != true) close(stats, i);
+			}
+			ops.resize(sliding.size());
+			scratch.resize(sliding.size());
+			for (size_t k = 0; k < sliding.size(); k++) scratch[k] = searched[sliding[k]];
+			auto start = clock::now();
+			slide.take_actions(before.data(), ops.data(), sliding.size(), scratch.data());
+			auto share = (clock::now() - start) / std::max<size_t>(sliding.size(), 1);
+			for (size_t k = 0; k < sliding.size(); k++) {
+				size_t i = sliding[k];
+				searched[i] = scratch[k];
+				if (ops[k] == -1 || games[i].apply_action(action::slide(ops[k]), elapse(i, share, ops[k] != -1)) != true) close(stats, i);
+			}
+		}
+	}
+
+protected:
+	typedef std::chrono::steady_clock clock;
+
+	/**
+	 * advance the clock of the lane by the duration, return the milliseconds it passes on the clock
+	 * with search set, the microseconds it passes are also added to the search time of the game
+	 */
+	time_t elapse(size_t i, clock::duration duration, bool search = false) {
+		std::chrono::nanoseconds from = now[i];
+		now[i] += std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+		if (search) searched[i].usec += std::chrono::duration_cast<std::chrono::microseconds>(now[i]).count()
+		                              - std::chrono::duration_cast<std::chrono::microseconds>(from).count();
+		return millisec(now[i]) - millisec(from);
+	}
+	static time_t millisec(std::chrono::nanoseconds time) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(time).count();
+	}
+
+	/**
+	 * start the next game in the lane, if more games are needed
+	 */
+	void open(statistics& stats, size_t i) {
+		playing[i] = stats.claim_episode();
+		if (!playing[i]) return;
+		index[i] = claimed++;
+		places[i]->seed(seed + index[i]);
+		places[i]->open_episode(slide.name() + ":~");
+		searched[i] = {};
+		now[i] = std::chrono::system_clock::now().time_since_epoch();
+		games[i].clear();
+		games[i].open_episode(slide.name() + ":" + places[i]->name(), millisec(now[i]));
+	}
+
+	/**
+	 * finish the game in the lane, commit it (and the later ones which are already finished) in order,
+	 * and start the next game in the lane
+	 */
+	void close(statistics& stats, size_t i) {
+		episode& game = games[i];
+		agent& win = game.last_turns(slide, *places[i]);
+		game.close_episode(win.name(), millisec(now[i]));
+		game.search(searched[i]);
+		places[i]->close_episode(win.name());
+		finished[index[i]] = std::move(game);
+		for (auto it = finished.begin(); it != finished.end() && it->first == committed; it = finished.erase(it)) {
+			stats.commit_episode(std::move(it->second));
+			committed++;
+		}
+		open(stats, i);
+	}
+
+private:
+	weight_slider& slide;
+	std::vector<std::unique_ptr<random_placer>> places;
+	std::vector<episode> games;
+	std::vector<bool> playing;
+	std::vector<size_t> index; // the index of the game in each lane
+	std::vector<search_stats> searched; // the search statistics of the game in each lane
+	std::vector<search_stats> scratch; // the search statistics of the sliding lanes in a step
+	std::vector<std::chrono::nanoseconds> now; // the clock of each lane, see the class comment
+	std::map<size_t, episode> finished; // the finished games waiting for the earlier ones
+	unsigned seed;
+	size_t claimed;
+	size_t committed;
+};
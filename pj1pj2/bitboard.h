@@ -0,0 +1,258 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bitboard.h: Define the packed 64-bit board of the game of Threes!
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include "board.h"
+
+/**
+ * bit-packed board for Threes!, 4 bits per cell in a single 64-bit integer
+ *
+ * the cell with 1-d index (i) is stored at bits [4i, 4i + 4), i.e.,
+ * row r is the 16-bit word at bits [16r, 16r + 16), whose lowest nibble is the leftmost cell
+ *
+ * the attributes (hint tile, last action, and bag) are kept in the same format as board,
+ * and the interface follows board so that both can be used interchangeably
+ */
+class bitboard {
+public:
+	typedef board::cell cell;
+	typedef uint16_t row;
+	typedef uint64_t grid;
+	typedef board::data data;
+	typedef board::score score;
+	typedef board::reward reward;
+
+public:
+	bitboard() : tile(0), attr(0) { reset(); }
+	bitboard(grid b, data v) : tile(b), attr(v) {}
+	bitboard(const board& b) : tile(0), attr(b.info()) {
+		for (unsigned i = 0; i < 16; i++) tile |= grid(b(i) & 0x0f) << (i << 2);
+	}
+	bitboard(const bitboard& b) = default;
+	bitboard& operator =(const bitboard& b) = default;
+
+	operator board() const {
+		board b({}, attr);
+		for (unsigned i = 0; i < 16; i++) b(i) = operator()(i);
+		return b;
+	}
+
+	grid raw() const { return tile; }
+	row operator [](unsigned r) const { return row(tile >> (r << 4)); }
+	cell operator ()(unsigned i) const { return (tile >> (i << 2)) & 0x0f; }
+	void set(unsigned i, cell t) { tile = (tile & ~(grid(0x0f) << (i << 2))) | (grid(t & 0x0f) << (i << 2)); }
+
+	data info() const { return attr; }
+	data info(data dat) { data old = attr; attr = dat; return old; }
+
+private:
+	data info4(size_t i) const { return (info() >> (4 * i)) & 0x0fu; }
+	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
+
+public:
+	cell hint() const { return info4(0); }
+	cell hint(cell t) { return info4(0, t); }
+	unsigned last() const { return info4(1); }
+	unsigned last(unsigned a) { return info4(1, a); }
+	unsigned bag(cell t) const { return info4(t + 1); }
+	unsigned bag(cell t, unsigned n) { return info4(t + 1, n); }
+
+	void reset() {
+		hint(0);
+		last(4);
+		reset_bag();
+	}
+	void reset_bag() {
+		for (cell t = 1; t <= 3; t++) bag(t, 1);
+	}
+	bool extract_hint_from_bag(cell t) {
+		if (bag(t) < 1) return false;
+		bag(t, bag(t) - 1);
+		if (bag(1) + bag(2) + bag(3) == 0) reset_bag();
+		hint(t);
+		return true;
+	}
+	unsigned value() const {
+		score v = 0;
+		for (unsigned i = 0; i < 16; i++) v += board::itov(operator()(i));
+		return v;
+	}
+
+public:
+	bool operator ==(const bitboard& b) const { return tile == b.tile; }
+	bool operator < (const bitboard& b) const { return tile <  b.tile; }
+	bool operator !=(const bitboard& b) const { return !(*this == b); }
+	bool operator > (const bitboard& b) const { return b < *this; }
+	bool operator <=(const bitboard& b) const { return !(b < *this); }
+	bool operator >=(const bitboard& b) const { return !(*this < b); }
+
+public:
+
+	/**
+	 * place a tile (index value) to the specific position (1-d index)
+	 * return >= 0 if the action is valid, or -1 if not
+	 */
+	reward place(unsigned pos, cell tile, cell hint_tile) {
+		data bak = info();
+		if (pos >= 16 || operator()(pos)) return -1;
+		if (hint() == 0 && !extract_hint_from_bag(tile)) return -1;
+		if (hint() != tile) return info(bak), -1;
+		if (!extract_hint_from_bag(hint_tile)) return info(bak), -1;
+		set(pos, tile);
+		last(4);
+		return board::itov(tile);
+	}
+
+	/**
+	 * apply an action to the board
+	 * return the reward of the action, or -1 if the action is illegal
+	 */
+	reward slide(unsigned opcode) {
+		reward r = -1;
+		switch (opcode & 0b11) {
+		case 0: r = slide_up(); break;
+		case 1: r = slide_right(); break;
+		case 2: r = slide_down(); break;
+		case 3: r = slide_left(); break;
+		}
+		if (r != -1) last(opcode & 0b11);
+		return r;
+	}
+
+	reward slide_left() { return slide_rows(0); }
+	reward slide_right() { return slide_rows(1); }
+	reward slide_up() {
+		transpose();
+		reward score = slide_rows(0);
+		transpose();
+		return score;
+	}
+	reward slide_down() {
+		transpose();
+		reward score = slide_rows(1);
+		transpose();
+		return score;
+	}
+
+	void rotate(int clockwise_count = 1) {
+		switch (((clockwise_count % 4) + 4) % 4) {
+		default:
+		case 0: break;
+		case 1: rotate_clockwise(); break;
+		case 2: reverse(); break;
+		case 3: rotate_counterclockwise(); break;
+		}
+	}
+
+	void rotate_clockwise() { transpose(); reflect_horizontal(); }
+	void rotate_counterclockwise() { transpose(); reflect_vertical(); }
+	void reverse() { reflect_horizontal(); reflect_vertical(); }
+
+	void reflect_horizontal() {
+		tile = ((tile & 0x000f000f000f000full) << 12) | ((tile & 0x00f000f000f000f0ull) << 4)
+		     | ((tile & 0x0f000f000f000f00ull) >> 4) | ((tile & 0xf000f000f000f000ull) >> 12);
+	}
+
+	void reflect_vertical() {
+		tile = (tile << 48) | ((tile & 0x00000000ffff0000ull) << 16)
+		     | ((tile & 0x0000ffff00000000ull) >> 16) | (tile >> 48);
+	}
+
+	void transpose() {
+		grid t = tile;
+		// swap the off-diagonal cells inside each 2x2 block, then swap the off-diagonal 2x2 blocks
+		t = (t & 0xf0f00f0ff0f00f0full) | ((t & 0x0000f0f00000f0f0ull) << 12) | ((t & 0x0f0f00000f0f0000ull) >> 12);
+		t = (t & 0xff00ff0000ff00ffull) | ((t & 0x00ff00ff00000000ull) >> 24) | ((t & 0x00000000ff00ff00ull) << 24);
+		tile = t;
+	}
+
+protected:
+	/**
+	 * the result of sliding a single row, indexed by the 16-bit row
+	 */
+	struct transition {
+		row result;
+		bool moved;
+		reward score;
+	};
+
+	/**
+	 * the transition tables of left (0) and right (1) slides, generated at startup
+	 */
+	static transition (&transitions())[2][65536] { static transition t[2][65536]; return t; }
+
+	/**
+	 * slide all rows toward the left (dir = 0) or the right (dir = 1) by table lookup
+	 * the board is unchanged and -1 is returned if no tile can be moved
+	 */
+	reward slide_rows(unsigned dir) {
+		const transition* table = transitions()[dir];
+		grid res = 0;
+		reward score = 0;
+		bool moved = false;
+		for (int r = 0; r < 4; r++) {
+			const transition& t = table[row(tile >> (r << 4))];
+			res |= grid(t.result) << (r << 4);
+			score += t.score;
+			moved |= t.moved;
+		}
+		if (!moved) return -1;
+		tile = res;
+		return score;
+	}
+
+	static __attribute__((constructor)) void init_transitions() {
+		for (unsigned r = 0; r < 65536; r++) {
+			cell t[4];
+			for (int c = 0; c < 4; c++) t[c] = (r >> (c << 2)) & 0x0f;
+			bool moved = false;
+			reward score = 0;
+			for (int c = 1; c < 4; c++) {
+				cell& t0 = t[c - 1];
+				cell& t1 = t[c];
+				if (t0 == 0) {
+					t0 = t1;
+					t1 = 0;
+					moved |= (t0 != 0);
+				} else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14))) {
+					t0 = std::max(t0, t1) + 1;
+					t1 = 0;
+					score += board::itov(t0) - board::itov(t0 - 1) * 2;
+					moved = true;
+				}
+			}
+			row res = 0;
+			for (int c = 0; c < 4; c++) res |= row(t[c] << (c << 2));
+			transitions()[0][r] = { res, moved, moved ? score : 0 };
+			// a right slide is a left slide of the mirrored row
+			transitions()[1][reflect_row(r)] = { reflect_row(res), moved, moved ? score : 0 };
+		}
+	}
+
+	static row reflect_row(row r) {
+		return row(((r & 0x000f) << 12) | ((r & 0x00f0) << 4) | ((r & 0x0f00) >> 4) | ((r & 0xf000) >> 12));
+	}
+
+public:
+	friend std::ostream& operator <<(std::ostream& out, const bitboard& b) {
+		return out << board(b);
+	}
+	friend std::istream& operator >>(std::istream& in, bitboard& b) {
+		board tmp({}, b.info());
+		in >> tmp;
+		b = tmp;
+		return in;
+	}
+
+private:
+	grid tile;
+	data attr; // same as board::attr
+};
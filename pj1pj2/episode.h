@@ -16,31 +16,53 @@
 #include <chrono>
 #include <numeric>
 #include "board.h"
+#include "bitboard.h"
 #include "action.h"
 #include "agent.h"
 
 class episode {
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) {}
 
 public:
+	/**
+	 * reset the episode for a new game, while keeping the allocated moves for reuse
+	 */
+	void clear() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_search = {};
+		ep_open = {};
+		ep_close = {};
+	}
+
 	board& state() { return ep_state; }
 	const board& state() const { return ep_state; }
 	board::score score() const { return ep_score; }
 
-	void open_episode(const std::string& tag) {
-		ep_open = { tag, millisec() };
+	void open_episode(const std::string& tag, time_t when = millisec()) {
+		ep_open = { tag, when };
 	}
-	void close_episode(const std::string& tag) {
-		ep_close = { tag, millisec() };
+	void close_episode(const std::string& tag, time_t when = millisec()) {
+		ep_close = { tag, when };
 	}
 	bool apply_action(action move) {
+		return apply_action(move, millisec() - ep_time);
+	}
+	/**
+	 * apply the move which took the given milliseconds, for a caller which measures the time by itself
+	 */
+	bool apply_action(action move, time_t time) {
 		board::reward reward = move.apply(state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		ep_moves.emplace_back(move, reward, time);
 		ep_score += reward;
 		return true;
 	}
+	const search_stats& search() const { return ep_search; }
+	void search(const search_stats& info) { ep_search = info; }
 	agent& take_turns(agent& slide, agent& place) {
 		ep_time = millisec();
 		return step() >= 9 && (step() - 8) % 2 ? slide : place;
@@ -119,6 +141,65 @@ public:
 		return in;
 	}
 
+	/**
+	 * write the episode as a compact binary record, which is
+	 *   the open and the close meta: the tag (varint length and bytes) and the time (varint)
+	 *   the score (varint), and the final state: 16 packed cells (8 bytes) and the attributes (varint)
+	 *   the number of moves (varint), and then each move as
+	 *     the action: a slide in 1 byte (0b0rt000oo), or a place in 2 bytes (0b1rt0pppp, hint << 4 | tile)
+	 *     the reward (varint) if the flag r is set, and the time (varint) if the flag t is set
+	 * the score and the final state are stored so that reading needs no replay
+	 */
+	void write(std::ostream& out) const {
+		ep_open.write(out);
+		ep_close.write(out);
+		write_varint(out, ep_score);
+		write_fixed(out, bitboard(ep_state).raw());
+		write_varint(out, ep_state.info());
+		write_varint(out, ep_moves.size());
+		for (const move& mv : ep_moves) mv.write(out);
+	}
+	/**
+	 * read an episode written by write, return false if the record is broken
+	 */
+	bool read(std::istream& in) {
+		*this = {};
+		uint64_t score, attr, size;
+		if (!ep_open.read(in) || !ep_close.read(in)) return false;
+		if (!read_varint(in, score)) return false;
+		uint64_t tile = read_fixed(in);
+		if (!read_varint(in, attr) || !read_varint(in, size)) return false;
+		ep_score = score;
+		ep_state = bitboard(tile, attr);
+		ep_moves.resize(size);
+		for (move& mv : ep_moves)
+			if (!mv.read(in)) return false;
+		return bool(in);
+	}
+
+	static void write_varint(std::ostream& out, uint64_t v) {
+		for (; v >= 0x80; v >>= 7) out.put(char(v | 0x80));
+		out.put(char(v));
+	}
+	static bool read_varint(std::istream& in, uint64_t& v) {
+		v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			int c = in.get();
+			if (c == EOF) return false;
+			v |= uint64_t(c & 0x7f) << shift;
+			if ((c & 0x80) == 0) return true;
+		}
+		return false;
+	}
+	static void write_fixed(std::ostream& out, uint64_t v) {
+		for (int i = 0; i < 8; i++) out.put(char(v >> (i << 3)));
+	}
+	static uint64_t read_fixed(std::istream& in) {
+		uint64_t v = 0;
+		for (int i = 0; i < 8; i++) v |= uint64_t(uint8_t(in.get())) << (i << 3);
+		return v;
+	}
+
 protected:
 
 	struct move {
@@ -150,6 +231,36 @@ protected:
 			}
 			return in;
 		}
+
+		void write(std::ostream& out) const {
+			unsigned event = code.event();
+			unsigned flag = (reward ? 0x40 : 0) | (time ? 0x20 : 0);
+			if (code.type() == action::slide::type) {
+				out.put(char(flag | (event & 0b11)));
+			} else { // action::place
+				out.put(char(0x80 | flag | (event & 0x0f)));
+				out.put(char(event >> 4));
+			}
+			if (reward) write_varint(out, reward);
+			if (time) write_varint(out, time);
+		}
+		bool read(std::istream& in) {
+			int c = in.get();
+			if (c == EOF) return false;
+			if (c & 0x80) {
+				int e = in.get();
+				if (e == EOF) return false;
+				code = action::place(c & 0x0f, e & 0x0f, (e >> 4) & 0x0f);
+			} else {
+				code = action::slide(c & 0b11);
+			}
+			uint64_t r = 0, t = 0;
+			if ((c & 0x40) && !read_varint(in, r)) return false;
+			if ((c & 0x20) && !read_varint(in, t)) return false;
+			reward = r;
+			time = t;
+			return true;
+		}
 	};
 
 	struct meta {
@@ -163,6 +274,21 @@ protected:
 		friend std::istream& operator >>(std::istream& in, meta& m) {
 			return std::getline(in, m.tag, '@') >> std::dec >> m.when;
 		}
+
+		void write(std::ostream& out) const {
+			write_varint(out, tag.size());
+			out.write(tag.data(), tag.size());
+			write_varint(out, when);
+		}
+		bool read(std::istream& in) {
+			uint64_t size, time;
+			if (!read_varint(in, size)) return false;
+			tag.resize(size);
+			if (!in.read(&tag[0], size)) return false;
+			if (!read_varint(in, time)) return false;
+			when = time;
+			return true;
+		}
 	};
 
 	static board initial_state() {
@@ -178,6 +304,7 @@ private:
 	board::score ep_score;
 	std::vector<move> ep_moves;
 	time_t ep_time;
+	search_stats ep_search;
 
 	meta ep_open;
 	meta ep_close;
@@ -0,0 +1,242 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * expectimax.h: Expectimax search for the slider of Threes!
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include "board.h"
+#include "bitboard.h"
+#include "weight.h"
+
+/**
+ * the accumulated statistics of searches, e.g., of the slider in an episode
+ */
+struct search_stats {
+	size_t moves; // number of searches
+	size_t depth; // sum of the reached depths
+	size_t nodes; // sum of the visited nodes
+	uint64_t usec; // sum of the search time in microseconds
+	search_stats() : moves(0), depth(0), nodes(0), usec(0) {}
+	search_stats& operator +=(const search_stats& s) {
+		moves += s.moves;
+		depth += s.depth;
+		nodes += s.nodes;
+		usec += s.usec;
+		return *this;
+	}
+};
+
+/**
+ * expectimax search with a given number of slides (plies)
+ *
+ * a max node (before state) takes the slide with the highest reward plus the value of its afterstate
+ * a chance node (afterstate) averages over all empty cells on the placing margin (uniformly),
+ * and all possible next hint tiles (weighted by the number of each tile left in the bag);
+ * the afterstates of the last ply are evaluated by the n-tuple network
+ *
+ * the values of chance nodes are cached in a transposition table, keyed on the packed board,
+ * the attributes (hint, last action, and bag), and the remaining plies
+ */
+class expectimax {
+public:
+	typedef double (*estimator)(const std::vector<weight>&, const bitboard&);
+
+	expectimax(unsigned cache_bits = 16) : table(size_t(1) << cache_bits), mask((size_t(1) << cache_bits) - 1),
+		generation(0), net(nullptr), estimate(nullptr), visited(0), limited(false), aborted(false) {}
+
+	typedef std::chrono::steady_clock clock;
+
+public:
+	/**
+	 * search the before state with the given plies (>= 1), return the best slide, or -1 if no slide is legal
+	 * the expected value of the best slide, i.e., reward plus value of its afterstate, is stored in value
+	 */
+	int search(const bitboard& before, unsigned depth, const std::vector<weight>& weights, estimator evaluate, double* value = nullptr) {
+		prepare(weights, evaluate);
+		limited = false;
+		int best = -1;
+		double best_value = max_node(before, depth, &best);
+		if (value) *value = best_value;
+		return best;
+	}
+
+	/**
+	 * search the before state iteratively deeper from 1 ply, until max_depth plies are searched or
+	 * the time budget (in microseconds) runs out; the first ply is always finished
+	 * each iteration searches the slides in the order of the values from the previous iteration,
+	 * so that an unfinished iteration can still be used if it has re-evaluated the previous best slide
+	 * return the best slide, or -1 if no slide is legal, and store the deepest finished plies in reached
+	 */
+	int deepen(const bitboard& before, unsigned max_depth, uint64_t budget, const std::vector<weight>& weights, estimator evaluate, unsigned* reached = nullptr) {
+		prepare(weights, evaluate);
+		deadline = clock::now() + std::chrono::microseconds(budget);
+		limited = false;
+		int order[4] = { 0, 1, 2, 3 };
+		double value[4];
+		int best = -1;
+		unsigned finished = 0;
+		for (unsigned depth = 1; depth <= max_depth; depth++) {
+			int iter_best = -1;
+			bool done = true;
+			for (int i = 0; i < 4 && done; i++) {
+				int op = order[i];
+				bitboard after = before;
+				board::reward reward = after.slide(op);
+				value[op] = -std::numeric_limits<double>::infinity();
+				if (reward == -1) continue;
+				double v = reward + (depth > 1 ? chance_node(after, depth - 1) : estimate(*net, after));
+				if (aborted) { // keep the last iteration unless the previous best (order[0]) is re-evaluated
+					done = false;
+					break;
+				}
+				value[op] = v;
+				if (iter_best == -1 || v > value[iter_best]) iter_best = op;
+			}
+			if (iter_best != -1) best = iter_best;
+			if (!done || best == -1) break;
+			finished = depth;
+			std::stable_sort(order, order + 4, [&](int a, int b) { return value[a] > value[b]; });
+			limited = true; // only the first ply is guaranteed to finish
+			if (clock::now() >= deadline) break;
+		}
+		if (reached) *reached = finished;
+		return best;
+	}
+
+	/**
+	 * the number of nodes visited since the engine is constructed
+	 */
+	size_t nodes() const { return visited; }
+
+	/**
+	 * the cells on which a new tile may be placed, indexed by the last slide
+	 */
+	static const unsigned (&margins())[4][4] {
+		static const unsigned margin[4][4] = { { 12, 13, 14, 15 }, { 0, 4, 8, 12 }, { 0, 1, 2, 3 }, { 3, 7, 11, 15 } };
+		return margin;
+	}
+
+protected:
+	void prepare(const std::vector<weight>& weights, estimator evaluate) {
+		net = &weights;
+		estimate = evaluate;
+		aborted = false;
+		if (++generation == 0) { // the cached values are only valid for the current weights
+			for (entry& e : table) e.generation = 0;
+			generation = 1;
+		}
+	}
+
+	/**
+	 * check the deadline every 256 nodes, and abort the search once it has passed
+	 */
+	bool timeout() {
+		if (limited && !aborted && (visited & 0xff) == 0) aborted = clock::now() >= deadline;
+		return aborted;
+	}
+
+	/**
+	 * the value of a before state, or 0 if it is terminal
+	 */
+	double max_node(const bitboard& before, unsigned depth, int* best_op = nullptr) {
+		visited++;
+		if (timeout()) return 0;
+		double best = 0;
+		int best_op_found = -1;
+		for (int op = 0; op < 4; op++) {
+			bitboard after = before;
+			board::reward reward = after.slide(op);
+			if (reward == -1) continue;
+			double value = reward + (depth > 1 ? chance_node(after, depth - 1) : estimate(*net, after));
+			if (best_op_found == -1 || value > best) {
+				best = value;
+				best_op_found = op;
+			}
+		}
+		if (best_op) *best_op = best_op_found;
+		return best;
+	}
+
+	/**
+	 * the expected value of an afterstate, before the remaining plies of slides
+	 */
+	double chance_node(const bitboard& after, unsigned depth) {
+		entry& cache = lookup(after, depth);
+		if (cache.generation == generation && cache.tile == after.raw() && cache.tag == tag(after, depth))
+			return cache.value;
+		visited++;
+		if (timeout()) return 0;
+
+		unsigned empty = 0;
+		const unsigned* margin = margins()[after.last() & 0b11];
+		for (int i = 0; i < 4; i++) empty += (after(margin[i]) == 0);
+		unsigned total = after.bag(1) + after.bag(2) + after.bag(3);
+
+		double value = 0;
+		if (empty == 0 || total == 0) {
+			value = estimate(*net, after);
+		} else {
+			for (int i = 0; i < 4; i++) {
+				if (after(margin[i]) != 0) continue;
+				if (depth == 1) { // the next hint tile is never placed within the remaining ply, so any of them will do
+					board::cell hint = after.bag(1) ? 1 : after.bag(2) ? 2 : 3;
+					bitboard before = after;
+					before.place(margin[i], after.hint(), hint);
+					value += max_node(before, depth) * total;
+					continue;
+				}
+				for (board::cell hint = 1; hint <= 3; hint++) {
+					if (after.bag(hint) == 0) continue;
+					bitboard before = after;
+					before.place(margin[i], after.hint(), hint);
+					value += max_node(before, depth) * after.bag(hint);
+				}
+			}
+			value /= double(empty) * total;
+		}
+		if (aborted) return 0; // the value is incomplete
+
+		cache.tile = after.raw();
+		cache.tag = tag(after, depth);
+		cache.generation = generation;
+		cache.value = value;
+		return value;
+	}
+
+protected:
+	struct entry {
+		uint64_t tile;
+		uint32_t tag;
+		uint32_t generation;
+		double value;
+		entry() : tile(0), tag(0), generation(0), value(0) {}
+	};
+
+	static uint32_t tag(const bitboard& after, unsigned depth) {
+		return uint32_t(after.info() & 0xfffff) | (depth << 20);
+	}
+	entry& lookup(const bitboard& after, unsigned depth) {
+		uint64_t h = (after.raw() ^ (uint64_t(tag(after, depth)) << 40)) * 0x9e3779b97f4a7c15ull;
+		return table[(h ^ (h >> 29)) & mask];
+	}
+
+private:
+	std::vector<entry> table;
+	size_t mask;
+	uint32_t generation;
+	const std::vector<weight>* net;
+	estimator estimate;
+	size_t visited;
+	clock::time_point deadline;
+	bool limited;
+	bool aborted;
+};
@@ -0,0 +1,289 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * ntuple.h: Compile-time specialized n-tuple networks
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "bitboard.h"
+#include "weight.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * a tuple of cells (1-d index), whose feature index is
+ *   b(cells[0]) + b(cells[1]) * base + b(cells[2]) * base^2 + ...
+ */
+template<unsigned... cells> struct pattern {};
+
+/**
+ * the cell of the original board which appears at cell (p) of the k-th isomorphic board, where
+ * k = 0 ~ 3 rotates the board clockwise k times, and
+ * k = 4 ~ 7 reflects the board vertically and then rotates it clockwise (k - 4) times
+ */
+constexpr unsigned rotate_cell(unsigned p, unsigned k) {
+	return k ? rotate_cell((3 - p % 4) * 4 + p / 4, k - 1) : p;
+}
+constexpr unsigned reflect_cell(unsigned p) {
+	return (3 - p / 4) * 4 + p % 4;
+}
+constexpr unsigned isomorphic_cell(unsigned k, unsigned p) {
+	return k < 4 ? rotate_cell(p, k) : reflect_cell(rotate_cell(p, k - 4));
+}
+constexpr size_t power(size_t base, size_t n) {
+	return n ? base * power(base, n - 1) : 1;
+}
+
+/**
+ * n-tuple network with patterns and isomorphisms fixed at compile time
+ *
+ * the indices of all isomorphic patterns are template arguments, so that a board is
+ * evaluated in one pass without rotating or reflecting it, in the order of
+ *   for each isomorphism k: for each pattern f: net[f][index of pattern f on the k-th isomorphic board]
+ *
+ * for networks with 8 isomorphisms, estimate_simd and update_simd compute the indices of
+ * the 8 isomorphisms of a pattern in one AVX2 vector, and fetch the weights by gathering;
+ * the sum is still accumulated in the above order, so both paths give identical results
+ * use simd() to check whether they are supported by the network and the running CPU
+ *
+ * estimate_batch (and estimate_batch_simd) evaluate an array of boards: the indices of a chunk of boards
+ * are computed and prefetched before any weight is read, so that the cache misses of the boards overlap
+ */
+template<unsigned base, unsigned isomorphisms, class... patterns>
+class ntuple {
+public:
+	/**
+	 * the number of weight tables used by this network
+	 */
+	static constexpr size_t tables() { return sizeof...(patterns); }
+
+	/**
+	 * the number of entries needed by each weight table, i.e., base^n for a pattern of n cells
+	 */
+	static std::vector<size_t> sizes() {
+		return { size_t(entries<patterns>::value)... };
+	}
+
+	static double estimate(const std::vector<weight>& net, const bitboard& b) {
+		return isomorphism<0, isomorphisms>::estimate(net.data(), b, 0);
+	}
+
+	static void update(std::vector<weight>& net, const bitboard& b, double u) {
+		isomorphism<0, isomorphisms>::update(net.data(), b, u);
+	}
+
+	static void estimate_batch(const std::vector<weight>& net, const bitboard* b, double* value, size_t n) {
+		uint32_t index[chunk][isomorphisms][tables()];
+		for (size_t first = 0; first < n; first += chunk) {
+			size_t num = n - first < chunk ? n - first : chunk;
+			for (size_t i = 0; i < num; i++)
+				isomorphism<0, isomorphisms>::indices(b[first + i], index[i]);
+			sum(net, index, num, value + first);
+		}
+	}
+
+#if defined(__x86_64__)
+	static bool simd() {
+		return isomorphisms == 8 && __builtin_cpu_supports("avx2");
+	}
+
+	__attribute__((target("avx2")))
+	static double estimate_simd(const std::vector<weight>& net, const bitboard& b) {
+		alignas(32) float value[tables()][8];
+		vectorized<0, patterns...>::gather(net.data(), unpack(b), value);
+		double sum = 0;
+		for (unsigned k = 0; k < 8; k++)
+			for (size_t f = 0; f < tables(); f++) sum += value[f][k];
+		return sum;
+	}
+
+	__attribute__((target("avx2")))
+	static void update_simd(std::vector<weight>& net, const bitboard& b, double u) {
+		alignas(32) uint32_t index[tables()][8];
+		vectorized<0, patterns...>::indices(unpack(b), index);
+		for (unsigned k = 0; k < 8; k++)
+			for (size_t f = 0; f < tables(); f++) net[f][index[f][k]] += u;
+	}
+
+	__attribute__((target("avx2")))
+	static void estimate_batch_simd(const std::vector<weight>& net, const bitboard* b, double* value, size_t n) {
+		alignas(32) uint32_t transposed[tables()][8];
+		uint32_t index[chunk][isomorphisms][tables()];
+		for (size_t first = 0; first < n; first += chunk) {
+			size_t num = n - first < chunk ? n - first : chunk;
+			for (size_t i = 0; i < num; i++) {
+				vectorized<0, patterns...>::indices(unpack(b[first + i]), transposed);
+				for (unsigned k = 0; k < isomorphisms; k++)
+					for (size_t f = 0; f < tables(); f++) index[i][k][f] = transposed[f][k];
+			}
+			sum(net, index, num, value + first);
+		}
+	}
+#else
+	static bool simd() { return false; }
+	static double estimate_simd(const std::vector<weight>& net, const bitboard& b) { return estimate(net, b); }
+	static void update_simd(std::vector<weight>& net, const bitboard& b, double u) { update(net, b, u); }
+	static void estimate_batch_simd(const std::vector<weight>& net, const bitboard* b, double* value, size_t n) { estimate_batch(net, b, value, n); }
+#endif
+
+private:
+	static constexpr size_t chunk = 16; // the boards whose weights are prefetched together
+
+	/**
+	 * prefetch the weights of the indices of num boards, and then sum them up for each board
+	 * in the same order as estimate
+	 */
+	static void sum(const std::vector<weight>& net, const uint32_t (*index)[isomorphisms][tables()], size_t num, double* value) {
+		for (size_t i = 0; i < num; i++)
+			for (unsigned k = 0; k < isomorphisms; k++)
+				for (size_t f = 0; f < tables(); f++) __builtin_prefetch(&net[f][index[i][k][f]]);
+		for (size_t i = 0; i < num; i++) {
+			double v = 0;
+			for (unsigned k = 0; k < isomorphisms; k++)
+				for (size_t f = 0; f < tables(); f++) v += net[f][index[i][k][f]];
+			value[i] = v;
+		}
+	}
+
+	template<class> struct entries;
+	template<unsigned... cells> struct entries<pattern<cells...>> {
+		static constexpr size_t value = power(base, sizeof...(cells));
+	};
+
+	template<unsigned... cells> struct indexer;
+	template<unsigned cell, unsigned... cells> struct indexer<cell, cells...> {
+		static size_t index(const bitboard& b) { return b(cell) + base * indexer<cells...>::index(b); }
+	};
+	template<unsigned... cells> struct indexer {
+		static size_t index(const bitboard& b) { return 0; }
+	};
+
+	template<unsigned k, size_t f, class... rest> struct feature {
+		static double estimate(const weight* net, const bitboard& b, double value) { return value; }
+		static void update(weight* net, const bitboard& b, double u) {}
+		static void indices(const bitboard& b, uint32_t* index) {}
+	};
+	template<unsigned k, size_t f, unsigned... cells, class... rest> struct feature<k, f, pattern<cells...>, rest...> {
+		static size_t index(const bitboard& b) { return indexer<isomorphic_cell(k, cells)...>::index(b); }
+		static void indices(const bitboard& b, uint32_t* index) {
+			index[f] = uint32_t(feature::index(b));
+			feature<k, f + 1, rest...>::indices(b, index);
+		}
+		static double estimate(const weight* net, const bitboard& b, double value) {
+			value += net[f][index(b)];
+			return feature<k, f + 1, rest...>::estimate(net, b, value);
+		}
+		static void update(weight* net, const bitboard& b, double u) {
+			net[f][index(b)] += u;
+			feature<k, f + 1, rest...>::update(net, b, u);
+		}
+	};
+
+	template<unsigned k, unsigned n> struct isomorphism {
+		static double estimate(const weight* net, const bitboard& b, double value) {
+			value = feature<k, 0, patterns...>::estimate(net, b, value);
+			return isomorphism<k + 1, n>::estimate(net, b, value);
+		}
+		static void update(weight* net, const bitboard& b, double u) {
+			feature<k, 0, patterns...>::update(net, b, u);
+			isomorphism<k + 1, n>::update(net, b, u);
+		}
+		static void indices(const bitboard& b, uint32_t (*index)[tables()]) {
+			feature<k, 0, patterns...>::indices(b, index[k]);
+			isomorphism<k + 1, n>::indices(b, index);
+		}
+	};
+	template<unsigned n> struct isomorphism<n, n> {
+		static double estimate(const weight* net, const bitboard& b, double value) { return value; }
+		static void update(weight* net, const bitboard& b, double u) {}
+		static void indices(const bitboard& b, uint32_t (*index)[tables()]) {}
+	};
+
+#if defined(__x86_64__)
+	/**
+	 * expand the 16 cells into bytes, and broadcast them to both 128-bit lanes
+	 */
+	__attribute__((target("avx2")))
+	static __m256i unpack(const bitboard& b) {
+		__m128i raw = _mm_cvtsi64_si128(b.raw());
+		__m128i even = _mm_and_si128(raw, _mm_set1_epi8(0x0f));
+		__m128i odd = _mm_and_si128(_mm_srli_epi64(raw, 4), _mm_set1_epi8(0x0f));
+		return _mm256_broadcastsi128_si256(_mm_unpacklo_epi8(even, odd));
+	}
+
+	/**
+	 * the shuffle control which moves the cell of each isomorphism into the lowest byte of its 32-bit lane
+	 */
+	template<unsigned cell>
+	__attribute__((target("avx2")))
+	static __m256i shuffle() {
+		return _mm256_setr_epi32(
+			int(0x80808000u | isomorphic_cell(0, cell)), int(0x80808000u | isomorphic_cell(1, cell)),
+			int(0x80808000u | isomorphic_cell(2, cell)), int(0x80808000u | isomorphic_cell(3, cell)),
+			int(0x80808000u | isomorphic_cell(4, cell)), int(0x80808000u | isomorphic_cell(5, cell)),
+			int(0x80808000u | isomorphic_cell(6, cell)), int(0x80808000u | isomorphic_cell(7, cell)));
+	}
+
+	template<unsigned... cells> struct vector_indexer;
+	template<unsigned cell, unsigned... cells> struct vector_indexer<cell, cells...> {
+		__attribute__((target("avx2")))
+		static __m256i index(__m256i b) {
+			__m256i next = _mm256_mullo_epi32(vector_indexer<cells...>::index(b), _mm256_set1_epi32(base));
+			return _mm256_add_epi32(_mm256_shuffle_epi8(b, shuffle<cell>()), next);
+		}
+	};
+	template<unsigned... cells> struct vector_indexer {
+		__attribute__((target("avx2")))
+		static __m256i index(__m256i b) { return _mm256_setzero_si256(); }
+	};
+
+	template<size_t f, class... rest> struct vectorized {
+		__attribute__((target("avx2")))
+		static void gather(const weight* net, __m256i b, float (*value)[8]) {}
+		__attribute__((target("avx2")))
+		static void indices(__m256i b, uint32_t (*index)[8]) {}
+	};
+	template<size_t f, unsigned... cells, class... rest> struct vectorized<f, pattern<cells...>, rest...> {
+		__attribute__((target("avx2")))
+		static void gather(const weight* net, __m256i b, float (*value)[8]) {
+			__m256i index = vector_indexer<cells...>::index(b);
+			_mm256_store_ps(value[f], _mm256_i32gather_ps(&net[f][0], index, sizeof(float)));
+			vectorized<f + 1, rest...>::gather(net, b, value);
+		}
+		__attribute__((target("avx2")))
+		static void indices(__m256i b, uint32_t (*index)[8]) {
+			_mm256_store_si256(reinterpret_cast<__m256i*>(index[f]), vector_indexer<cells...>::index(b));
+			vectorized<f + 1, rest...>::indices(b, index);
+		}
+	};
+#endif
+};
+
+/**
+ * 4x6-tuple network with 8 isomorphisms, 15^6 entries per table
+ */
+typedef ntuple<15, 8,
+	pattern<0, 1, 2, 3, 4, 5>,
+	pattern<4, 5, 6, 7, 8, 9>,
+	pattern<5, 6, 7, 9, 10, 11>,
+	pattern<9, 10, 11, 13, 14, 15>> ntuple_4x6;
+
+/**
+ * 8x4-tuple network of all rows and columns without isomorphisms, 16^4 entries per table
+ */
+typedef ntuple<16, 1,
+	pattern<0, 1, 2, 3>,
+	pattern<4, 5, 6, 7>,
+	pattern<8, 9, 10, 11>,
+	pattern<12, 13, 14, 15>,
+	pattern<0, 4, 8, 12>,
+	pattern<1, 5, 9, 13>,
+	pattern<2, 6, 10, 14>,
+	pattern<3, 7, 11, 15>> ntuple_8x4;
@@ -12,6 +12,8 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <mutex>
 #include "board.h"
 #include "action.h"
 #include "episode.h"
@@ -29,7 +31,12 @@ public:
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  bounded(limit != 0),
+		  count(0),
+		  pending(0),
+		  streaming(false),
+		  sink(nullptr),
+		  sink_binary(false) {}
 
 public:
 	/**
@@ -52,53 +59,21 @@ public:
 	 *                                   the average speed of the placer is 955796
 	 * '84.1%': 84.1% of the games reached 24-tiles, i.e., win rate of 24-tile
 	 * '45.3%': 45.3% of the games terminated with 24-tiles as the largest tile
+	 *
+	 * if the slider reports its searches, a line such as
+	 *         depth = 2.71, nps = 3712400
+	 * follows the first line, i.e., the average reached depth and the visited nodes per second
 	 */
 	void show(bool tstat = true, size_t blk = 0) const {
+		record rec;
 		size_t num = std::min(data.size(), blk ?: block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::score sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < num; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
-		}
-
-		std::ios ff(nullptr);
-		ff.copyfmt(std::cout);
-		std::cout << std::fixed << std::setprecision(0);
-		std::cout << count << "\t";
-		std::cout << "avg = " << (sum / num) << ", ";
-		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
-		std::cout << std::endl;
-		std::cout.copyfmt(ff);
-
-		if (!tstat) return;
-		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
-			if (stat[t] == 0) continue;
-			size_t accu = std::accumulate(std::begin(stat) + t, std::end(stat), size_t(0));
-			std::cout << "\t" << board::itot(t); // type
-			std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
-			std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
-			std::cout << std::endl;
-		}
-		std::cout << std::endl;
+		for (auto it = data.end() - num; it != data.end(); it++) rec.add(*it);
+		show(rec, tstat);
 	}
 
 	void summary() const {
-		show(true, data.size());
+		if (streaming) show(overall);
+		else show(true, data.size());
 	}
 
 	bool is_finished() const {
@@ -106,14 +81,68 @@ public:
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
+		if (count++ >= limit && !streaming) data.pop_front();
 		data.emplace_back();
 		data.back().open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		collect(data.back());
+		if (streaming) data.pop_back();
+	}
+
+	/**
+	 * claim an episode to be played, return false if no more episodes are needed
+	 *
+	 * this and commit_episode are thread-safe, so that parallel game runners can
+	 * play their own episodes and commit the finished ones here
+	 */
+	bool claim_episode() {
+		std::lock_guard<std::mutex> lock(guard);
+		if (count + pending >= total) return false;
+		pending++;
+		return true;
+	}
+
+	/**
+	 * commit a finished episode which is previously claimed by claim_episode
+	 *
+	 * the episode is moved into the records, or is left untouched in the streaming mode,
+	 * so that the runner can clear and reuse it for the next game
+	 */
+	void commit_episode(episode&& ep) {
+		std::lock_guard<std::mutex> lock(guard);
+		pending--;
+		count++;
+		collect(ep);
+		if (streaming) return;
+		if (count > limit) data.pop_front();
+		data.push_back(std::move(ep));
+	}
+
+	/**
+	 * switch to the streaming mode, in which no episode is retained:
+	 * the statistics are aggregated incrementally, and each episode is written to out (if given)
+	 * as soon as it is finished, in the binary format (see write) or the text format
+	 *
+	 * the episodes recorded so far are written and aggregated first
+	 * call finish after the last episode to complete the binary index
+	 */
+	void stream(std::ostream* out = nullptr, bool binary = false) {
+		streaming = true;
+		sink = out;
+		sink_binary = binary;
+		if (sink && sink_binary) sink->write(magic(), 8);
+		for (const episode& rec : data) {
+			overall.add(rec);
+			dump(rec);
+		}
+		data.clear();
+	}
+	void finish() {
+		if (sink && sink_binary) write_index(*sink, index);
+		if (sink) sink->flush();
 	}
 
 	episode& at(size_t i) {
@@ -140,13 +169,173 @@ public:
 		}
 		stat.total = std::max(stat.total, stat.data.size());
 		stat.count = stat.data.size();
+		stat.recount();
 		return in;
 	}
 
+	/**
+	 * write the records in the binary format, which is
+	 *   the magic "THREESEP", the episodes (see episode::write), and the index:
+	 *   the offset of each episode (8 bytes each), the number of episodes (8 bytes), and the magic again
+	 */
+	void write(std::ostream& out) const {
+		std::vector<uint64_t> index;
+		index.reserve(data.size());
+		out.write(magic(), 8);
+		for (const episode& rec : data) {
+			index.push_back(out.tellp());
+			rec.write(out);
+		}
+		write_index(out, index);
+	}
+	/**
+	 * read the records written by write, return false if the file is broken
+	 * all episodes are read, as the text format does, unless the limit is given explicitly, in which case
+	 * only the last 'limit' episodes are read through the index, while all of them are counted
+	 */
+	bool read(std::istream& in) {
+		char head[8], tail[8];
+		if (!in.read(head, 8) || !std::equal(head, head + 8, magic())) return false;
+		if (!in.seekg(-16, std::ios::end)) return false;
+		uint64_t num = episode::read_fixed(in);
+		if (!in.read(tail, 8) || !std::equal(tail, tail + 8, magic())) return false;
+		if (!in.seekg(-16 - std::streamoff(num * 8), std::ios::end)) return false;
+		std::vector<uint64_t> index(num);
+		for (uint64_t& offset : index) offset = episode::read_fixed(in);
+		size_t keep = bounded ? limit : num;
+		size_t first = num > keep ? num - keep : 0;
+		if (first < num && !in.seekg(index[first])) return false;
+		for (size_t i = first; i < num; i++) {
+			data.emplace_back();
+			if (!data.back().read(in)) return false;
+		}
+		total = std::max(total, size_t(num));
+		count = num;
+		recount();
+		return true;
+	}
+
+protected:
+	/**
+	 * the counters of a set of episodes, which can be updated incrementally
+	 */
+	struct record {
+		size_t num;
+		size_t stat[64];
+		size_t sop, pop, eop;
+		time_t sdu, pdu, edu;
+		board::score sum, max;
+		search_stats srch;
+
+		record() : num(0), stat(), sop(0), pop(0), eop(0), sdu(0), pdu(0), edu(0), sum(0), max(0) {}
+		void add(const episode& ep) {
+			num++;
+			srch += ep.search();
+			sum += ep.score();
+			max = std::max(ep.score(), max);
+			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
+			sop += ep.step();
+			pop += ep.step(action::slide::type);
+			eop += ep.step(action::place::type);
+			sdu += ep.time();
+			pdu += ep.time(action::slide::type);
+			edu += ep.time(action::place::type);
+		}
+	};
+
+	void show(const record& rec, bool tstat = true) const {
+		size_t num = rec.num;
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(0);
+		std::cout << count << "\t";
+		std::cout << "avg = " << (rec.sum / num) << ", ";
+		std::cout << "max = " << (rec.max) << ", ";
+		std::cout << "ops = " << (rec.sop * 1000.0 / rec.sdu);
+		std::cout <<     " (" << (rec.pop * 1000.0 / rec.pdu);
+		std::cout <<      "|" << (rec.eop * 1000.0 / rec.edu) << ")";
+		std::cout << std::endl;
+		if (rec.srch.moves) {
+			std::cout << "\t" << std::setprecision(2);
+			std::cout << "depth = " << (rec.srch.depth * 1.0 / rec.srch.moves) << ", " << std::setprecision(0);
+			std::cout << "nps = " << (rec.srch.nodes * 1000000.0 / rec.srch.usec);
+			std::cout << std::endl;
+		}
+		std::cout.copyfmt(ff);
+
+		if (!tstat) return;
+		const size_t* stat = rec.stat;
+		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
+			if (stat[t] == 0) continue;
+			size_t accu = std::accumulate(stat + t, stat + 64, size_t(0));
+			std::cout << "\t" << board::itot(t); // type
+			std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
+			std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
+			std::cout << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
+	/**
+	 * aggregate a finished episode, show the block if it is completed, and write it to the sink
+	 */
+	void collect(const episode& ep) {
+		current.add(ep);
+		if (count % block == 0) {
+			show(current);
+			current = {};
+		}
+		if (streaming) {
+			overall.add(ep);
+			dump(ep);
+		}
+	}
+
+	void dump(const episode& ep) {
+		if (!sink) return;
+		if (sink_binary) {
+			index.push_back(sink->tellp());
+			ep.write(*sink);
+		} else {
+			*sink << ep << std::endl;
+		}
+	}
+
+	/**
+	 * rebuild the counters of the current block from the loaded records
+	 * the block and the limit default to the loaded total if they were derived from a zero total
+	 */
+	void recount() {
+		if (!block) block = total;
+		if (!limit) limit = total;
+		current = {};
+		if (!block) return;
+		size_t num = std::min(data.size(), count % block);
+		for (auto it = data.end() - num; it != data.end(); it++) current.add(*it);
+	}
+
+	static void write_index(std::ostream& out, const std::vector<uint64_t>& index) {
+		for (uint64_t offset : index) episode::write_fixed(out, offset);
+		episode::write_fixed(out, index.size());
+		out.write(magic(), 8);
+	}
+
+	static const char* magic() { return "THREESEP"; }
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
+	bool bounded; // whether the limit is given explicitly
 	size_t count;
+	size_t pending;
 	std::deque<episode> data;
+	std::mutex guard;
+
+	record current; // the counters of the current block
+	record overall; // the counters of all episodes, only in the streaming mode
+	bool streaming;
+	std::ostream* sink;
+	bool sink_binary;
+	std::vector<uint64_t> index; // the offsets of the episodes written to a binary sink
 };
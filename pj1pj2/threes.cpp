@@ -11,18 +11,25 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistics.h"
+#include "batch.h"
 
 int main(int argc, const char* argv[]) {
 	std::cout << "Threes! Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
-	size_t total = 1000, block = 0, limit = 0;
+	size_t total = 1000, block = 0, limit = 0, threads = 1, batch = 0;
+	bool stream = false;
 	std::string slide_args, place_args;
 	std::string load_path, save_path;
 	for (int i = 1; i < argc; i++) {
@@ -49,46 +56,118 @@ int main(int argc, const char* argv[]) {
 			load_path = next_opt();
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("threads")) {
+			threads = std::max(std::stoull(next_opt()), 1ull);
+		} else if (match_arg("batch")) {
+			batch = std::stoull(next_opt());
+		} else if (match_arg("stream")) {
+			stream = true;
 		}
 	}
 
 	statistics stats(total, block, limit);
+	auto binary_path = [](const std::string& path) -> bool { // the compact binary format is used for *.bin
+		return path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+	};
 
 	if (load_path.size()) {
-		std::ifstream in(load_path, std::ios::in);
-		in >> stats;
-		in.close();
+		if (binary_path(load_path)) {
+			std::ifstream in(load_path, std::ios::in | std::ios::binary);
+			if (!stats.read(in)) std::exit(-1);
+		} else {
+			std::ifstream in(load_path, std::ios::in);
+			in >> stats;
+		}
 		if (stats.is_finished()) stats.summary();
 	}
 
+	std::ofstream sink;
+	if (stream) { // aggregate the statistics incrementally, and write the episodes to the file as soon as they are finished
+		if (save_path.size()) sink.open(save_path, std::ios::out | std::ios::trunc | std::ios::binary);
+		stats.stream(sink.is_open() ? &sink : nullptr, binary_path(save_path));
+	}
+
 	weight_slider slide(slide_args);
 	random_placer place(place_args);
 
-	while (!stats.is_finished()) {
-//		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
-		slide.open_episode("~:" + place.name());
-		place.open_episode(slide.name() + ":~");
+	std::stringstream place_ss(place_args);
+	unsigned seed = 1; // the default seed of std::default_random_engine
+	for (std::string pair; place_ss >> pair; )
+		if (pair.substr(0, pair.find('=')) == "seed") seed = std::stoul(pair.substr(pair.find('=') + 1));
+	std::atomic<size_t> claimed(0); // the index of the next game, by which its placer is seeded as in the batch mode
+
+	auto play = [&](weight_slider& slide, random_placer& place) {
+		episode game;
+		while (stats.claim_episode()) {
+//			std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
+			place.seed(seed + claimed++);
+			slide.open_episode("~:" + place.name());
+			place.open_episode(slide.name() + ":~");
+
+			game.clear();
+			game.open_episode(slide.name() + ":" + place.name());
+			while (true) {
+				agent& who = game.take_turns(slide, place);
+				action move = who.take_action(game.state());
+//				std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
+				if (game.apply_action(move) != true) break;
+				if (who.check_for_win(game.state())) break;
+			}
+			agent& win = game.last_turns(slide, place);
+			game.close_episode(win.name());
+			game.search(slide.search_info());
+			stats.commit_episode(std::move(game));
 
-		stats.open_episode(slide.name() + ":" + place.name());
-		episode& game = stats.back();
-		while (true) {
-			agent& who = game.take_turns(slide, place);
-			action move = who.take_action(game.state());
-//			std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) break;
+			slide.close_episode(win.name());
+			place.close_episode(win.name());
 		}
-		agent& win = game.last_turns(slide, place);
-		stats.close_episode(win.name());
+	};
 
-		slide.close_episode(win.name());
-		place.close_episode(win.name());
+	if (batch) { // play the games in lanes, where the slides of all lanes are chosen together
+		if (!slide.batchable()) {
+			std::cerr << "batch requires a slider of depth=1 or depth=2 without learning (alpha=0) and time budget" << std::endl;
+			std::exit(-1);
+		}
+		batch_evaluator eval(slide, place_args, batch, seed);
+		eval.run(stats);
+	} else if (threads > 1) { // each worker plays its own games, and all sliders train the same network
+		auto worker_args = [](const std::string& args, size_t i) -> std::string {
+			std::stringstream ss(args);
+			std::string res;
+			size_t seed = 1; // the default seed of std::default_random_engine
+			for (std::string pair; ss >> pair; ) {
+				std::string key = pair.substr(0, pair.find('='));
+				if (key == "init" || key == "load" || key == "save") continue; // handled by the master
+				if (key == "seed") seed = std::stoull(pair.substr(pair.find('=') + 1));
+				else res += pair + " ";
+			}
+			return res + "seed=" + std::to_string(seed + i);
+		};
+		std::vector<std::unique_ptr<weight_slider>> slides;
+		std::vector<std::unique_ptr<random_placer>> places;
+		for (size_t i = 1; i < threads; i++) {
+			slides.emplace_back(new weight_slider(worker_args(slide_args, i), &slide));
+			places.emplace_back(new random_placer(worker_args(place_args, i)));
+		}
+		std::vector<std::thread> workers;
+		for (size_t i = 1; i < threads; i++)
+			workers.emplace_back(play, std::ref(*slides[i - 1]), std::ref(*places[i - 1]));
+		play(slide, place);
+		for (std::thread& worker : workers) worker.join();
+	} else {
+		play(slide, place);
 	}
 
-	if (save_path.size()) {
-		std::ofstream out(save_path, std::ios::out | std::ios::trunc);
-		out << stats;
-		out.close();
+	if (stream) {
+		stats.finish();
+	} else if (save_path.size()) {
+		if (binary_path(save_path)) {
+			std::ofstream out(save_path, std::ios::out | std::ios::trunc | std::ios::binary);
+			stats.write(out);
+		} else {
+			std::ofstream out(save_path, std::ios::out | std::ios::trunc);
+			out << stats;
+		}
 	}
 
 	return 0;
@@ -10,40 +10,167 @@
 #pragma once
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <string>
 #include <utility>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+/**
+ * lookup table of an n-tuple network
+ *
+ * note that copies of a weight share the same table (shallow copy),
+ * so that several agents can train one network together (e.g., in parallel threads)
+ */
 class weight {
 public:
 	typedef float type;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
+	weight() : length(0) {}
+	weight(size_t len) : value(new type[len](), std::default_delete<type[]>()), length(len) {}
+	weight(const std::shared_ptr<void>& owner, type* data, size_t len) : value(owner, data), length(len) {}
+	weight(weight&& f) : value(std::move(f.value)), length(f.length) { f.length = 0; }
 	weight(const weight& f) = default;
 
 	weight& operator =(const weight& f) = default;
-	type& operator[] (size_t i) { return value[i]; }
-	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	type& operator[] (size_t i) { return value.get()[i]; }
+	const type& operator[] (size_t i) const { return value.get()[i]; }
+	size_t size() const { return length; }
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		out.write(reinterpret_cast<const char*>(w.value.get()), sizeof(type) * size);
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		w = weight(size);
+		in.read(reinterpret_cast<char*>(w.value.get()), sizeof(type) * size);
 		return in;
 	}
 
 protected:
-	std::vector<type> value;
+	std::shared_ptr<type> value;
+	size_t length;
+};
+
+/**
+ * memory-mapped weight file, whose layout is the same as the streamed one, i.e.,
+ * a uint32_t count of tables, then a uint64_t size and the values for each table
+ * the sizes are not 8-byte aligned in the file, so they are accessed by std::memcpy
+ *
+ * the tables are views of the mapping and keep it alive, and the mapping can be
+ * readonly:      shared read-only pages, e.g., for evaluation in several processes
+ * copy_on_write: private writable pages, the file is never modified
+ * write_back:    shared writable pages, updates are written back to the file by sync()
+ */
+class weight_file : public std::enable_shared_from_this<weight_file> {
+public:
+	enum mode { readonly, copy_on_write, write_back };
+
+	/**
+	 * map an existing weight file, return nullptr if the file is missing or malformed
+	 */
+	static std::shared_ptr<weight_file> open(const std::string& path, mode how) {
+		int fd = ::open(path.c_str(), how == write_back ? O_RDWR : O_RDONLY);
+		if (fd == -1) return nullptr;
+		struct stat st;
+		size_t len = ::fstat(fd, &st) == 0 ? st.st_size : 0;
+		void* addr = len ? ::mmap(nullptr, len, how == readonly ? PROT_READ : PROT_READ | PROT_WRITE,
+		                          how == copy_on_write ? MAP_PRIVATE : MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (addr == MAP_FAILED) return nullptr;
+		std::shared_ptr<weight_file> file(new weight_file(path, how, addr, len));
+		return file->valid() ? file : nullptr;
+	}
+
+	/**
+	 * create (or overwrite) a zero-initialized weight file with the given table sizes,
+	 * and map it in write_back mode
+	 */
+	static std::shared_ptr<weight_file> create(const std::string& path, const std::vector<size_t>& sizes) {
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1) return nullptr;
+		size_t len = sizeof(uint32_t);
+		for (size_t size : sizes) len += sizeof(uint64_t) + sizeof(weight::type) * size;
+		bool ok = ::ftruncate(fd, len) == 0;
+		void* addr = ok ? ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (addr == MAP_FAILED) return nullptr;
+		char* ptr = static_cast<char*>(addr);
+		uint32_t count = sizes.size();
+		std::memcpy(ptr, &count, sizeof(uint32_t));
+		ptr += sizeof(uint32_t);
+		for (uint64_t size : sizes) {
+			std::memcpy(ptr, &size, sizeof(uint64_t));
+			ptr += sizeof(uint64_t) + sizeof(weight::type) * size;
+		}
+		return std::shared_ptr<weight_file>(new weight_file(path, write_back, addr, len));
+	}
+
+	~weight_file() { ::munmap(addr, len); }
+
+public:
+	/**
+	 * the tables stored in this file
+	 */
+	std::vector<weight> tables() {
+		std::vector<weight> net;
+		char* ptr = static_cast<char*>(addr);
+		uint32_t count;
+		std::memcpy(&count, ptr, sizeof(uint32_t));
+		ptr += sizeof(uint32_t);
+		for (uint32_t i = 0; i < count; i++) {
+			uint64_t size;
+			std::memcpy(&size, ptr, sizeof(uint64_t));
+			ptr += sizeof(uint64_t);
+			net.emplace_back(shared_from_this(), reinterpret_cast<weight::type*>(ptr), size);
+			ptr += sizeof(weight::type) * size;
+		}
+		return net;
+	}
+
+	/**
+	 * check whether the declared tables fit in the file
+	 */
+	bool valid() const {
+		size_t pos = sizeof(uint32_t);
+		if (pos > len) return false;
+		uint32_t count;
+		std::memcpy(&count, addr, sizeof(uint32_t));
+		for (uint32_t i = 0; i < count; i++) {
+			if (pos + sizeof(uint64_t) > len) return false;
+			uint64_t size;
+			std::memcpy(&size, static_cast<const char*>(addr) + pos, sizeof(uint64_t));
+			pos += sizeof(uint64_t);
+			if (size > (len - pos) / sizeof(weight::type)) return false;
+			pos += sizeof(weight::type) * size;
+		}
+		return true;
+	}
+
+	/**
+	 * flush the updates to the file, return false if it is not mapped in write_back mode
+	 */
+	bool sync() {
+		return how == write_back && ::msync(addr, len, MS_SYNC) == 0;
+	}
+
+	const std::string& path() const { return name; }
+	mode access() const { return how; }
+
+private:
+	weight_file(const std::string& path, mode how, void* addr, size_t len) : name(path), how(how), addr(addr), len(len) {}
+
+	std::string name;
+	mode how;
+	void* addr;
+	size_t len;
 };
@@ -24,11 +24,11 @@ public:
 	class white; // create a placing action of white with position
 
 public:
-	virtual board::reward apply(board& b) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-		return -1;
-	}
+	/**
+	 * apply the action to the board, dispatched statically on the type after the subclasses are defined
+	 * the prototypes in entries() are only for the text I/O
+	 */
+	board::reward apply(board& b) const;
 	virtual std::ostream& operator >>(std::ostream& out) const {
 		auto proto = entries().find(type());
 		if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
@@ -118,3 +118,12 @@ protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) white(*a); }
 	static __attribute__((constructor)) void init() { entries()[type_flag('W')] = new white; }
 };
+
+inline board::reward action::apply(board& b) const {
+	switch (type()) {
+	case place::type: return action::place(*this).apply(b);
+	case black::type: return action::black(*this).apply(b);
+	case white::type: return action::white(*this).apply(b);
+	default: return -1;
+	}
+}
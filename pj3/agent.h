@@ -17,9 +17,14 @@
 #include <fstream>
 #include "board.h"
 #include "action.h"
+#include "rollout.h"
+#include "timer.h"
 #include <vector>
 #include <chrono>
 #include <ctime> 
+#include <atomic>
+#include <thread>
+#include <memory>
 using namespace std;
 class agent {
 public:
@@ -65,142 +70,537 @@ public:
 	}
 	virtual ~random_agent() {}
 
+	/**
+	 * restart the random engines, e.g., so that the moves of a game do not depend on the earlier games
+	 */
+	virtual void seed(uint64_t s) { engine.seed(s); }
+
 protected:
 	std::default_random_engine engine;
 };
 
 class Mcts {
 	private:
-		struct Node{
-			int visittime;
-			int wintime;
-			board position;
-			int rvisit;
-			int rwin;
-			vector<Node*> mapActionToChild;
-			vector<board::point> legal;
-			vector<Node*> childs;
-			std::default_random_engine engine;
-			board::point fromWhichMove;
-			Node(): visittime(0), wintime(0), rvisit(0), rwin(0){}
-			Node(board b): visittime(0), wintime(0), position(b), rvisit(0), rwin(0){
-				int size_xy = board::size_x * board::size_y;
-				mapActionToChild.resize(size_xy, NULL);
-				for (int i = 0; i < size_xy; i++) {
-					board::point move(i);
-					board tem = b;
-					if (tem.place(move) == board::legal)
-						legal.push_back(move);
+		typedef uint32_t node_id;
+
+		/**
+		 * the arena of a search tree: compact fixed-size nodes and edges stored as arrays indexed by node_id
+		 * the root is always node 0, and the edges (the children) of a node occupy a contiguous range
+		 * [firstchild, firstchild + numchild); the position of a node is not stored but replayed
+		 * from the root during the selection; the whole tree is released by a single reset
+		 *
+		 * an edge holds the move and its RAVE statistics, and targets the node of the position after the move,
+		 * which is allocated only when the edge is first selected; a leaf is expanded (its edges are allocated)
+		 * only after a few visits, so that the tree grows by about one node and a few edges per simulation
+		 *
+		 * the statistics are atomic so that several threads can search the same tree;
+		 * a node is expanded by the thread which sets its expanding flag, and the edges are
+		 * published by storing numchild after firstchild and legal; an edge is linked to its node by a CAS on target
+		 *
+		 * positions reached by different move orders are merged by a transposition table, from the
+		 * Zobrist hash of a position to its node, so that the tree is actually a DAG: an edge whose position
+		 * is already in the table targets that node, and only keeps the RAVE statistics of its own move
+		 */
+		struct Arena {
+			/**
+			 * a fixed-size array which is left uninitialized, so that its pages are committed only once they are used;
+			 * the elements are initialized by allocate and branch instead
+			 */
+			template<class type> struct pool {
+				std::unique_ptr<type[]> data;
+				size_t length;
+				pool(size_t n) : data(new type[n]), length(n) {}
+				type& operator[](size_t i) { return data[i]; }
+				const type& operator[](size_t i) const { return data[i]; }
+				size_t size() const { return length; }
+			};
+
+			pool<std::atomic<int>> visittime;
+			pool<std::atomic<int>> wintime;
+			pool<node_id> firstchild;
+			pool<std::atomic<uint8_t>> numchild;
+			pool<bitboard::mask> legal; // the moves of the edges, so the edge of a move is found by its rank
+			pool<std::atomic<bool>> expanding;
+			std::atomic<size_t> allocated;
+
+			pool<std::atomic<int>> rvisit; // the statistics of the edges
+			pool<std::atomic<int>> rwin;
+			pool<uint8_t> fromWhichMove; // the point of the move of the edge
+			pool<std::atomic<node_id>> target; // the node of the position after the move, or -1 if not selected yet
+			std::atomic<size_t> branched;
+			std::atomic<size_t> transposed; // the number of edges which target a node of another edge
+
+			pool<std::atomic<uint64_t>> keys; // the transposition table with linear probing, 0 for an empty entry
+			pool<std::atomic<node_id>> entries; // which is valid only if its key is set
+			static constexpr unsigned probes = 8;
+
+			Arena(size_t capacity, size_t edges) : visittime(capacity), wintime(capacity),
+				firstchild(capacity), numchild(capacity), legal(capacity), expanding(capacity), allocated(0),
+				rvisit(edges), rwin(edges), fromWhichMove(edges), target(edges),
+				branched(0), transposed(0), keys(table_size(capacity)), entries(keys.size()) { clear(); }
+
+			size_t capacity() const { return visittime.size(); }
+			size_t used() const { return std::min<size_t>(allocated, capacity()); }
+			size_t edges() const { return std::min<size_t>(branched, target.size()); }
+			void reset() {
+				if (allocated) clear(); // otherwise it is clean, since nothing is inserted without allocating first
+			}
+			void clear() {
+				allocated = 0;
+				branched = 0;
+				transposed = 0;
+				for (size_t i = 0; i < keys.size(); i++) keys[i] = 0;
+			}
+
+			/**
+			 * the node of the position with the hash, or -1 if it is not in the table (or is being inserted)
+			 */
+			node_id lookup(uint64_t key) const {
+				size_t mask = keys.size() - 1;
+				for (size_t i = key & mask, n = 0; n < probes; i = (i + 1) & mask, n++) {
+					uint64_t k = keys[i];
+					if (k == key) return entries[i];
+					if (k == 0) break;
+				}
+				return node_id(-1);
+			}
+
+			/**
+			 * insert the node of the position with the hash, unless the hash is already in the table
+			 * or its probing sequence is full, in which case the node is simply not merged
+			 */
+			void insert(uint64_t key, node_id id) {
+				size_t mask = keys.size() - 1;
+				for (size_t i = key & mask, n = 0; n < probes && key; i = (i + 1) & mask, n++) {
+					uint64_t k = 0;
+					if (keys[i].compare_exchange_strong(k, key)) {
+						entries[i] = id;
+						return;
+					}
+					if (k == key) return;
 				}
-				std::shuffle(legal.begin(), legal.end(), engine);
+			}
+
+			static size_t table_size(size_t capacity) {
+				size_t size = 1;
+				while (size < capacity) size <<= 1;
+				return size;
+			}
+
+			/**
+			 * allocate a leaf node, return its id, or -1 if the arena is full
+			 */
+			node_id allocate() {
+				size_t id = allocated.fetch_add(1);
+				if (id >= capacity()) return node_id(-1);
+				visittime[id] = wintime[id] = 0;
+				numchild[id] = 0;
+				expanding[id] = false;
+				return id;
+			}
+
+			/**
+			 * allocate n contiguous edges without targets, return the first id, or -1 if the arena is full
+			 */
+			node_id branch(size_t n) {
+				size_t first = branched.fetch_add(n);
+				if (first + n > target.size()) return node_id(-1);
+				for (size_t id = first; id < first + n; id++) {
+					rvisit[id] = rwin[id] = 0;
+					target[id] = node_id(-1);
+				}
+				return first;
 			}
 		};
 
+		/**
+		 * the state owned by each searching thread
+		 */
+		struct Worker {
+			rollout playout;
+			bitboard::mask amaf[3]; // the moves of each color after the current node, in the tree and in the playout
+			int result; // the result of the playout of this thread, which is credited to the AMAF statistics
+			size_t sims;
+			Arena* tree; // the tree searched by this thread
+			Worker(uint64_t seed = 0) : playout(seed), amaf{0, 0, 0}, result(0), sims(0), tree(nullptr) {}
+		};
+
+		/**
+		 * the leaf shared with the helper threads in the leaf parallelization,
+		 * from which each helper runs one playout per round
+		 */
+		struct Leaf {
+			const board* position = nullptr;
+			board::piece_type mover = board::empty;
+			std::atomic<unsigned> round{0};
+			std::atomic<unsigned> pending{0};
+			std::atomic<int> wins{0};
+			std::atomic<bool> stop{false};
+		};
+
 	public:
-		Mcts() : blackspace(board::size_x * board::size_y),
+		/**
+		 * the parallelization with multiple threads:
+		 * tree: the threads search a shared tree, with virtual loss
+		 * root: each thread searches its own tree with its own seed, and the visits of the root children are merged
+		 * leaf: a single tree, in which each leaf is evaluated by one playout from each thread
+		 */
+		enum parallelization { tree_parallel, root_parallel, leaf_parallel };
+		static parallelization parse_parallelization(const std::string& mode) {
+			if (mode == "tree") return tree_parallel;
+			if (mode == "root") return root_parallel;
+			if (mode == "leaf") return leaf_parallel;
+			throw std::invalid_argument("invalid parallel: " + mode);
+		}
+
+		/**
+		 * a search with the arenas of the given nodes and edges in total, which are built by the first search
+		 */
+		Mcts(size_t capacity = size_t(1) << 20, size_t edges = size_t(1) << 23, size_t threads = 1, parallelization mode = tree_parallel) :
+									workers(std::max<size_t>(threads, 1)), parallel(mode), capacity(capacity), edge_capacity(edges),
+									blackspace(board::size_x * board::size_y),
 									whitespace(board::size_x * board::size_y) {
 			for (int i = 0; i < (int)blackspace.size(); i++)
 				blackspace[i] = action::place(i, board::black);
 			for (int i = 0; i < (int)whitespace.size(); i++)
 				whitespace[i] = action::place(i, board::white);
-			int size_xy = board::size_x * board::size_y;
-			traverseHistory.resize(size_xy, 0);
+			for (size_t i = 0; i < workers.size(); i++)
+				workers[i].playout.seed(i);
 		}
 		void setWho(board::piece_type type) {
 			who = type;
 		}
+
+		/**
+		 * derive all the random engines from the seed, i.e., the engine of the search
+		 * and the playout engine of each thread, so that a search with a fixed number of simulations
+		 * is reproducible with a single thread, or with the root or the leaf parallelization
+		 */
+		void seed(uint64_t seed) {
+			engine.seed(seed);
+			for (size_t i = 0; i < workers.size(); i++) { // splitmix64, so that the threads draw unrelated streams
+				uint64_t x = seed + (i + 1) * 0x9e3779b97f4a7c15ull;
+				x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+				x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+				workers[i].playout.seed(x ^ (x >> 31));
+			}
+		}
+		void setVerbose(bool v) {
+			verbose = v;
+		}
 		void setRoot(const board& b) {
-			root = new Node(b);
+			stop_ponder();
+			build();
+			for (size_t t = 0; t < trees.size(); t++) setRoot(t);
+			rootposition = b;
+		}
+
+		/**
+		 * advance the root to the given position, which should follow the current root by our move and the reply,
+		 * so that the subtree of the matching grandchild is kept as the new root, and the others are released
+		 * return false if there is no such grandchild in any tree, in which case the trees are unchanged;
+		 * otherwise the trees without such grandchild restart from the new root
+		 * the trees are kept if the position is the root itself, i.e., it has been advanced while pondering
+		 */
+		bool advance(const board& b) {
+			stop_ponder();
+			const bitboard& now = b.bits();
+			const bitboard& old = rootposition.bits();
+			board::piece_type opp = board::piece_type(3 - who);
+			if (trees.empty()) return false;
+			if (now.stones(who) == old.stones(who) && now.stones(opp) == old.stones(opp)) return trees[0]->used() != 0;
+			if ((old.stones(who) & ~now.stones(who)) || (old.stones(opp) & ~now.stones(opp))) return false;
+			bitboard::mask mine = now.stones(who) & ~old.stones(who);
+			bitboard::mask reply = now.stones(opp) & ~old.stones(opp);
+			if (bitboard::count(mine) != 1 || bitboard::count(reply) != 1) return false;
+			std::vector<node_id> grandchild(trees.size(), node_id(-1));
+			bool found = false;
+			for (size_t t = 0; t < trees.size(); t++) {
+				if (trees[t]->used() == 0) continue;
+				node_id child = find(*trees[t], root, bitboard::lowest(mine));
+				if (child == node_id(-1)) continue;
+				grandchild[t] = find(*trees[t], child, bitboard::lowest(reply));
+				found |= (grandchild[t] != node_id(-1));
+			}
+			if (!found) return false;
+			for (size_t t = 0; t < trees.size(); t++) {
+				if (grandchild[t] != node_id(-1)) promote(t, grandchild[t]);
+				else setRoot(t);
+			}
+			rootposition = b;
+			return true;
 		}
 
 		void mctsopen_episode(const std::string& flag = "") {
-			sims_count = 0;
-		}
-
-		void mcts_simulate(){
-			clock_t start;
-			start = clock();
-			sims_count++;
-			float clocktime;
-			if(sims_count<=3) clocktime = 4;
-			else if(sims_count<=8) clocktime = 7;
-			else if(sims_count<=15) clocktime = 10;
-			else if(sims_count<=20) clocktime = 11;
-			else if(sims_count<=25) clocktime = 9;
-			else if(sims_count<=30) clocktime = 5;
-			else clocktime = 3;
-			while((float) (clock()-start)/CLOCKS_PER_SEC<clocktime){
-				// cout << "simulation ############ " << endl;
-				sim(root);
-				// traverse(root);
-				for (int i = 0; i < (int)traverseHistory.size(); i++){
-					traverseHistory[i] = 0;
-				}
+			stop_ponder();
+			del_tree();
+		}
+
+		/**
+		 * search until the deadline, or until the most visited root move cannot be overtaken by the second one
+		 * within the visits expected before the deadline, at the rate of the visits so far
+		 */
+		void mcts_simulate(std::chrono::steady_clock::time_point deadline){
+			stop_ponder();
+			halt = false;
+			search(deadline);
+		}
+
+		/**
+		 * search exactly the given number of simulations regardless of the time, which are split evenly
+		 * among the threads, or are run by the main thread with the leaf parallelization
+		 */
+		void mcts_simulate(size_t simulations){
+			stop_ponder();
+			halt = false;
+			search(std::chrono::steady_clock::time_point::max(), -1, simulations);
+		}
+
+		/**
+		 * keep searching in the background during the turn of the opponent, from the child of our move,
+		 * so that the subtree of the reply is larger when the root is advanced by the next search
+		 */
+		void ponder(const action::place& move) {
+			stop_ponder();
+			halt = false;
+			ponderer = std::thread(&Mcts::search, this, std::chrono::steady_clock::time_point::max(), int(move.position().i), size_t(0));
+		}
+
+		/**
+		 * advance the root by the reply of the opponent while pondering, and keep pondering from the new root
+		 * return false if the reply is not in the trees, in which case pondering stops
+		 */
+		bool adopt(const board& b) {
+			if (!ponderer.joinable() || !advance(b)) return false;
+			halt = false;
+			ponderer = std::thread(&Mcts::search, this, std::chrono::steady_clock::time_point::max(), -1, size_t(0));
+			return true;
+		}
+		void stop_ponder() {
+			if (!ponderer.joinable()) return;
+			halt = true;
+			ponderer.join();
+		}
+		~Mcts() {
+			stop_ponder();
+		}
+
+		/**
+		 * whether the second most visited root move cannot catch up with the most visited one,
+		 * given the visits at the beginning of the search, and the elapsed and the remaining time
+		 */
+		bool decided(int start, std::chrono::steady_clock::duration elapsed, std::chrono::steady_clock::duration remaining) {
+			int visits[board::size_x * board::size_y] = { 0 };
+			int total = 0;
+			for (auto& tree : trees) {
+				const Arena& nodes = *tree;
+				unsigned n = nodes.numchild[root]; // load before firstchild, which is published before numchild
+				node_id first = n ? nodes.firstchild[root] : 0;
+				for (node_id child = first; child < first + n; child++)
+					visits[nodes.fromWhichMove[child]] += visits_of(nodes, child);
+				total += nodes.visittime[root];
+			}
+			int best = 0, second = 0;
+			for (int v : visits) {
+				if (v > best) second = best, best = v;
+				else if (v > second) second = v;
 			}
-			
-			//cout << "elapsed time: " << elapsed_seconds.count() << endl;
+			double expected = double(total - start) * remaining.count() / std::max<double>(elapsed.count(), 1);
+			return best - second > expected;
 		}
 
+		/**
+		 * the most visited move of the root, where the visits are summed over all trees
+		 */
 		action::place bestaction(){
-			int best = 0;
-			if(root->childs.empty()){
-				//cout << "weird" << endl;
-				//return action();
-				action::place p  = rand_action(root->position, true);
-				board tmp = root->position;
+			int visits[board::size_x * board::size_y] = { 0 };
+			bool expanded = false;
+			for (auto& tree : trees) {
+				const Arena& nodes = *tree;
+				node_id first = nodes.firstchild[root];
+				for (node_id child = first; child < first + nodes.numchild[root]; child++) {
+					visits[nodes.fromWhichMove[child]] += visits_of(nodes, child);
+					expanded = true;
+				}
+			}
+			if (!expanded) {
+				action::place p = rand_action(rootposition, true);
+				board tmp = rootposition;
 				if(p.apply(tmp)==board::legal){
 					return p;
 				}
+				return action();
 			}
-			else{
-				Node* bestchild = root->childs[0];
-				for(int i=0; i<(int)root->childs.size(); i++){
-					Node* child = root->childs[i];
-					if(child->visittime > best){
-						best = child->visittime;
-						bestchild = child;
-					}
-				}
-				std::vector<action::place>& tmpspace = (who==board::black)? blackspace:whitespace;
-				for(int i=0;i<(int)tmpspace.size();i++){
-					action::place next = tmpspace[i];
-					board& nextboard = bestchild->position;
-					board curposition = root->position;
-					if(next.apply(curposition) == board::legal && nextboard == curposition){
-						return next;
-					}
+			int best = -1, bestmove = 0;
+			for (bitboard::mask m = rootposition.legal_moves(who); m; m &= m - 1) {
+				unsigned move = bitboard::lowest(m);
+				if (visits[move] > best) {
+					best = visits[move];
+					bestmove = move;
 				}
 			}
-			// cout << "no available action\n";
-			return action();
+			return action::place(bestmove, who);
 		}
-		void del_tree(Node* node=nullptr) {
-			if (node == nullptr)
-				node = root;
-			for (int i = 0; i < (int)node->childs.size(); i++)
-				del_tree(node->childs[i]);
-			delete node;
+		void del_tree() {
+			stop_ponder();
+			for (auto& tree : trees) tree->reset();
 		}
 
 	private:
-		
 
-		Node* select(Node* curnode, bool myturn){
+		/**
+		 * build the arenas, where the nodes and the edges are split among the trees
+		 */
+		void build() {
+			if (trees.size()) return;
+			size_t num = (parallel == root_parallel) ? workers.size() : 1; // the nodes are shared by the trees
+			for (size_t i = 0; i < num; i++)
+				trees.emplace_back(new Arena(std::max<size_t>(capacity / num, 1), std::max<size_t>(edge_capacity / num, 1)));
+			for (size_t i = 0; i < workers.size(); i++)
+				workers[i].tree = trees[i % num].get();
+		}
+
+		void setRoot(size_t t) {
+			Arena& nodes = *trees[t];
+			nodes.reset();
+			nodes.allocate();
+		}
+
+		/**
+		 * search from the root with all threads until halted, the deadline, or the result is decided;
+		 * or search from the child of the move (with the opponent to move) until halted, if move is given
+		 * the deadline is time_point::max() when pondering, or when the number of simulations is given
+		 */
+		void search(std::chrono::steady_clock::time_point deadline, int move = -1, size_t simulations = 0) {
+			auto wall = std::chrono::steady_clock::now();
+			int reused = 0;
+			for (auto& tree : trees) reused += tree->visittime[root];
+			for (Worker& w : workers) w.sims = 0;
+			board from = rootposition;
+			if (move != -1) from.place(board::point(move), who);
+			auto run = [&](Worker& w) {
+				bool master = (&w == &workers[0]);
+				size_t quota = simulations; // the simulations of this thread, if given
+				if (simulations && parallel != leaf_parallel) {
+					size_t i = &w - &workers[0];
+					quota = simulations / workers.size() + (i < simulations % workers.size());
+				}
+				node_id start = (move == -1) ? root : find(*w.tree, root, move);
+				while (!halt && start != node_id(-1) && !(simulations && w.sims >= quota)) {
+					board position = from;
+					sim(*w.tree, start, position, w, parallel == tree_parallel && workers.size() > 1, move == -1);
+					w.sims++;
+					if (!master || move != -1 || simulations) continue;
+					auto now = std::chrono::steady_clock::now();
+					if (now >= deadline) halt = true;
+					else if ((w.sims & 0x3f) == 0 && decided(reused, now - wall, deadline - now)) halt = true;
+				}
+				leaf.stop = true;
+			};
+			leaf.stop = false;
+			std::vector<std::thread> threads;
+			for (size_t i = 1; i < workers.size(); i++) {
+				if (parallel == leaf_parallel)
+					threads.emplace_back(&Mcts::help, this, std::ref(workers[i]), unsigned(leaf.round));
+				else
+					threads.emplace_back(run, std::ref(workers[i]));
+			}
+			run(workers[0]);
+			for (std::thread& t : threads) t.join();
+			if (verbose) { // report the simulations per second of this search, of each thread and in total
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - wall;
+				std::string tag = (deadline == std::chrono::steady_clock::time_point::max() && !simulations) ? "ponder: " : "";
+				size_t total = 0, used = 0;
+				for (size_t i = 0; i < workers.size(); i++) {
+					total += workers[i].sims;
+					if (workers.size() > 1)
+						std::cerr << tag << "thread " << i << ": sims = " << workers[i].sims
+						          << ", sps = " << size_t(workers[i].sims / elapsed.count()) << std::endl;
+				}
+				size_t edges = 0, transposed = 0;
+				for (auto& tree : trees) used += tree->used(), edges += tree->edges(), transposed += tree->transposed;
+				std::cerr << tag << "playouts = " << total << ", pps = " << size_t(total / elapsed.count())
+				          << ", nodes = " << used << ", edges = " << edges << ", transposed = " << transposed
+				          << ", reused = " << reused << std::endl;
+			}
+		}
+
+		/**
+		 * the child of the node which is reached by the move, or -1 if there is no such child
+		 * or if it has never been selected
+		 */
+		node_id find(const Arena& nodes, node_id node, unsigned move) {
+			if (nodes.numchild[node] == 0 || !(nodes.legal[node] & bitboard::bit(move))) return node_id(-1);
+			return nodes.target[edge(nodes, node, move)];
+		}
+
+		/**
+		 * the edge of the move, which is in the legal moves of the expanded node
+		 */
+		node_id edge(const Arena& nodes, node_id node, unsigned move) const {
+			return nodes.firstchild[node] + bitboard::count(nodes.legal[node] & (bitboard::bit(move) - 1));
+		}
+
+		/**
+		 * move the sub-DAG of the node in the t-th tree to the front of the spare arena in breadth-first order,
+		 * and swap the arenas so that the node becomes the root
+		 * a node reached again through a transposition is moved only once, and the table is rebuilt
+		 */
+		void promote(size_t t, node_id node) {
+			const Arena& nodes = *trees[t];
+			if (!spare || spare->capacity() != nodes.capacity()) spare.reset(new Arena(nodes.capacity(), nodes.target.size()));
+			spare->reset();
+			remap.assign(nodes.used(), node_id(-1));
+			origin.clear();
+			origin.push_back(node);
+			remap[node] = spare->allocate();
+			for (node_id k = 0; k < spare->used(); k++) {
+				node_id from = origin[k];
+				spare->visittime[k] = int(nodes.visittime[from]);
+				spare->wintime[k] = int(nodes.wintime[from]);
+				spare->expanding[k] = bool(nodes.expanding[from]);
+				unsigned n = nodes.numchild[from];
+				if (n == 0) continue;
+				node_id first = spare->branch(n);
+				for (unsigned j = 0; j < n; j++) {
+					node_id child = nodes.firstchild[from] + j, next = nodes.target[child];
+					spare->rvisit[first + j] = int(nodes.rvisit[child]);
+					spare->rwin[first + j] = int(nodes.rwin[child]);
+					spare->fromWhichMove[first + j] = nodes.fromWhichMove[child];
+					if (next == node_id(-1)) continue;
+					if (remap[next] != node_id(-1)) {
+						spare->transposed++;
+					} else {
+						remap[next] = spare->allocate();
+						origin.push_back(next);
+					}
+					spare->target[first + j] = remap[next];
+				}
+				spare->firstchild[k] = first;
+				spare->legal[k] = nodes.legal[from];
+				spare->numchild[k] = n;
+			}
+			for (size_t i = 0; i < nodes.keys.size(); i++) {
+				node_id id = nodes.entries[i];
+				if (id < remap.size() && remap[id] != node_id(-1)) spare->insert(nodes.keys[i], remap[id]);
+			}
+			for (Worker& w : workers)
+				if (w.tree == trees[t].get()) w.tree = spare.get();
+			std::swap(trees[t], spare);
+		}
+
+		node_id select(const Arena& nodes, node_id curnode, bool myturn){
 			float bestvalue=-10000;
-			//Node* bestnode = new Node();
-			int bestchild = 0;
-			for(int i=0;i<(int)curnode->childs.size();i++){
-				//Node* child = curnode->childs[i];
-				//double val = uctvalue(*child, curnode->visittime);
-				double val = uctvalue(*curnode->childs[i], curnode->visittime, myturn);
+			node_id first = nodes.firstchild[curnode];
+			node_id bestchild = first;
+			for (node_id child = first; child < first + nodes.numchild[curnode]; child++) {
+				double val = uctvalue(nodes, child, nodes.visittime[curnode], myturn);
 				if(bestvalue < val){
 					bestvalue = val;
-					//bestnode = child;
-					bestchild = i;
+					bestchild = child;
 				}
-				
 			}
-			return curnode->childs[bestchild];
+			return bestchild;
 		}
 		bool isblack(bool myturn){
 			if((myturn && who==board::black)||(!myturn && who==board::white)){
@@ -208,122 +608,199 @@ class Mcts {
 			}
 			else return 0;
 		}
-		void expand(Node* node, bool myturn) {
-			std::vector<Node*> children;
-			std::vector<action::place>& tmpspace = (isblack(myturn)) ? blackspace : whitespace;
-			for(int i=0; i < (int) tmpspace.size();i++){
-				//cout << "inside 155 for loop\n";
-				action::place& nextmove = tmpspace[i];
-				board cur = node->position;
-				if (nextmove.apply(cur) == board::legal){
-					Node* child = new Node(cur);
-					if(children.size()==0){
-						child->fromWhichMove = nextmove.position();
-						// cout << nextmove.position().i << endl;
-						node->mapActionToChild[nextmove.position().i] = child;
-					}
-					children.push_back(child);
-				}
+		board::piece_type color(bool myturn) {
+			return isblack(myturn) ? board::black : board::white;
+		}
+		void expand(Arena& nodes, node_id node, const board& position, bool myturn) {
+			if (nodes.expanding[node].exchange(true)) return; // being expanded by another thread
+			bitboard::mask legal = position.legal_moves(color(myturn));
+			node_id first = nodes.branch(bitboard::count(legal));
+			if (first == node_id(-1)) { // the arena is full, keep it as a leaf
+				nodes.expanding[node] = false;
+				exhausted();
+				return;
+			}
+			node_id child = first;
+			for (bitboard::mask m = legal; m; m &= m - 1, child++)
+				nodes.fromWhichMove[child] = bitboard::lowest(m);
+			nodes.firstchild[node] = first;
+			nodes.legal[node] = legal;
+			nodes.numchild[node] = child - first;
+		}
+
+		/**
+		 * the node targeted by the edge, which is linked on the first selection of the edge, either to
+		 * the node of the same position in the table, or to a new node; return -1 if the arena is full
+		 */
+		node_id link(Arena& nodes, node_id child, const board& position, bool myturn) {
+			node_id next = nodes.target[child];
+			if (next != node_id(-1)) return next;
+			uint64_t key = position.hash() ^ bitboard::zobrist_turn() ^ bitboard::zobrist(nodes.fromWhichMove[child], color(myturn));
+			node_id same = nodes.lookup(key);
+			if (same != node_id(-1)) {
+				if (nodes.target[child].compare_exchange_strong(next, same)) nodes.transposed++;
+				return nodes.target[child];
 			}
-			node->childs = children;
-			// return children[0];
+			node_id leaf = nodes.allocate();
+			if (leaf == node_id(-1)) {
+				exhausted();
+				return node_id(-1);
+			}
+			if (!nodes.target[child].compare_exchange_strong(next, leaf)) return next; // linked by another thread, the leaf is wasted
+			nodes.insert(key, leaf);
+			return leaf;
+		}
+
+		/**
+		 * warn once that the tree stops growing, since the arena is full
+		 */
+		void exhausted() {
+			if (!warned.exchange(true))
+				std::cerr << "mcts: the arena of " << trees[0]->capacity() << " nodes and " << trees[0]->target.size()
+				          << " edges is full, increase nodes or edges" << std::endl;
+		}
+
+		int visits_of(const Arena& nodes, node_id child) const {
+			node_id next = nodes.target[child];
+			return next != node_id(-1) ? int(nodes.visittime[next]) : 0;
 		}
 
 
 		action::place rand_action(board& state, bool myturn){
 
-			std::vector<action::place> tmpspace = isblack(myturn)? blackspace : whitespace;
-			std::shuffle(tmpspace.begin(), tmpspace.end(), engine);
-			for (const action::place& move : tmpspace) {
-				board after = state;
-				if (move.apply(after) == board::legal){
-					return move;
-				}
-			}
-			action::place t = tmpspace[0];
-			tmpspace.clear();
-			tmpspace.shrink_to_fit();
-			return t; //illegal move
-		}
-		int simulate(const board& state, bool myturn){
-			int iswin = 1;
-			board tmp = state;
-			action::place p = rand_action(tmp,myturn);
-
-			while(p.apply(tmp)==board::legal){
-				myturn = !myturn;
-				p = rand_action(tmp, myturn);
-				iswin ++;
-				iswin = iswin % 2;
-				//cout << myturn << " " << iswin << endl;
+			std::vector<action::place>& tmpspace = isblack(myturn)? blackspace : whitespace;
+			bitboard::mask legal = state.legal_moves(color(myturn));
+			if (!legal) return tmpspace[0]; //illegal move
+			// pick the k-th legal point uniformly
+			for (unsigned k = engine() % bitboard::count(legal); k; k--) legal &= legal - 1;
+			return tmpspace[bitboard::lowest(legal)];
+		}
+		int simulate(const board& state, bool myturn, Worker& worker){
+			worker.result = worker.playout.run(state, color(myturn)) == unsigned(who);
+			worker.amaf[board::black] = worker.playout.moves(board::black);
+			worker.amaf[board::white] = worker.playout.moves(board::white);
+			return worker.result;
+		}
+
+		/**
+		 * run one playout from the leaf on every thread, return the number of wins
+		 */
+		int simulate_leaf(const board& state, bool myturn, Worker& worker){
+			leaf.position = &state;
+			leaf.mover = color(myturn);
+			leaf.wins = 0;
+			leaf.pending = workers.size() - 1;
+			leaf.round++;
+			int wins = simulate(state, myturn, worker);
+			while (leaf.pending) std::this_thread::yield();
+			return wins + leaf.wins;
+		}
+		void help(Worker& worker, unsigned round) {
+			for (;;) {
+				while (leaf.round == round && !leaf.stop) std::this_thread::yield();
+				if (leaf.round == round) break;
+				round = leaf.round;
+				leaf.wins += worker.playout.run(*leaf.position, leaf.mover) == unsigned(who);
+				worker.sims++;
+				leaf.pending--;
 			}
-			return !myturn;
-			//TODO: should return win or lose
-		}
-		
-		
-
-		void update(Node* node, int iswin){
-			node->visittime++;
-			node->wintime += iswin;
-			for (int i = 0; i < (int)traverseHistory.size(); i++) {
-				if (traverseHistory[i] && node->mapActionToChild[i] != NULL) {
-					node->mapActionToChild[i]->rvisit++;
-					node->mapActionToChild[i]->rwin += iswin;
-				}
+		}
+
+		/**
+		 * update the statistics of the node with the result of n playouts,
+		 * where the virtual loss added by select (if any) is replaced by the real result
+		 * every child whose move is played later by the same color, in the tree or in the playout,
+		 * is credited with the result of the playout of this thread by RAVE; only the credited
+		 * children are visited, each found by the rank of its move in the legal moves of the node
+		 */
+		void update(Arena& nodes, node_id node, int wins, int n, const Worker& worker, bool myturn, bool virtualloss){
+			nodes.visittime[node] += n - virtualloss;
+			nodes.wintime[node] += wins - (virtualloss && myturn);
+			if (nodes.numchild[node] == 0) return; // load before legal, as the node may be expanded by another thread
+			for (bitboard::mask m = worker.amaf[color(myturn)] & nodes.legal[node]; m; m &= m - 1) {
+				node_id child = edge(nodes, node, bitboard::lowest(m));
+				// a lost update between threads is negligible for RAVE, which saves the locked increments
+				nodes.rvisit[child].store(nodes.rvisit[child].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				nodes.rwin[child].store(nodes.rwin[child].load(std::memory_order_relaxed) + worker.result, std::memory_order_relaxed);
 			}
 		}
-		double uctvalue(Node& child, int cur_visittime, bool myturn){
-			if(child.visittime==0){
+		double uctvalue(const Arena& nodes, node_id child, int cur_visittime, bool myturn){
+			node_id node = nodes.target[child];
+			if(node == node_id(-1) || nodes.visittime[node]==0){
 				return 100000000;  // devide by zero
 			}
-			/*float exploitation = (float)child.wintime / (float)(child.visittime);
-			if(!myturn){
-				exploitation = 1 - exploitation;
-			}
-			float exploration = sqrt(log(cur_visittime) / (float)(child.visittime));*/
 
 			float c = 1.414;
 			float b = 0.025;
-			float beta = (float)child.rvisit /
-                ((float)child.visittime + (float)child.rvisit+ 4 * (float)child.visittime * (float)child.rvisit * b * b);
-			float winRate = (float)child.wintime/ (float)(child.visittime + 1);
-			float raveWinRate = (float)child.rwin / (float)(child.rvisit + 1);
+			float visittime = nodes.visittime[node], rvisit = nodes.rvisit[child];
+			float beta = rvisit / (visittime + rvisit + 4 * visittime * rvisit * b * b);
+			float winRate = (float)nodes.wintime[node] / (visittime + 1);
+			float raveWinRate = (float)nodes.rwin[child] / (rvisit + 1);
 
 			float exploitation;
 			if(myturn)
 				exploitation = (1 - beta) * winRate + beta * raveWinRate;
 			else
 				exploitation = (1 - beta) * (1 - winRate) + beta * (1 - raveWinRate);
-			float exploration = sqrt(log(cur_visittime) / (float)(child.visittime + 1));
+			float exploration = sqrt(log(cur_visittime) / (visittime + 1));
 			return exploitation + c * exploration;
 		}
 
-		int sim(Node* node, bool myturn=true){
+		/**
+		 * run a simulation from the node, whose position is given and is advanced along the selected path
+		 * a leaf is expanded once it has been visited enough, and a playout is run from the first node which
+		 * is not expanded, or from the position after the selected move if its node cannot be allocated
+		 * with virtual set, a virtual loss is added to each selected child, i.e., a visit which counts as
+		 * a loss for the side selecting it, so that other threads tend to select different paths
+		 */
+		int sim(Arena& nodes, node_id node, board& position, Worker& worker, bool virtual_loss = false, bool myturn = true, bool virtualloss = false){
 			int iswin;
-			if(node->childs.empty()){
-				iswin = simulate(node->position, myturn);
-				// cout << "start expand" << endl;
-				expand(node, myturn);
-				update(node,iswin);
+			int n = (parallel == leaf_parallel) ? workers.size() : 1; // the playouts of each simulation
+			if(nodes.numchild[node] == 0){
+				if (n > 1) iswin = simulate_leaf(position, myturn, worker);
+				else iswin = simulate(position, myturn, worker);
+				if (nodes.visittime[node] >= expansion + int(virtualloss)) expand(nodes, node, position, myturn);
 			}
 			else{
-				Node* next = select(node, myturn);
-				traverseHistory[next->fromWhichMove.i] = 1;
-				iswin = sim(next, !myturn);
-				update(node, iswin);
+				node_id next = select(nodes, node, myturn);
+				node_id child = link(nodes, next, position, myturn);
+				position.place(board::point(nodes.fromWhichMove[next]), color(myturn));
+				if (child == node_id(-1)) {
+					if (n > 1) iswin = simulate_leaf(position, !myturn, worker);
+					else iswin = simulate(position, !myturn, worker);
+				} else {
+					if (virtual_loss) { // the child is selected by this side (myturn), and the loss is counted for the next node's perspective
+						nodes.visittime[child]++;
+						if (!myturn) nodes.wintime[child]++;
+					}
+					iswin = sim(nodes, child, position, worker, virtual_loss, !myturn, virtual_loss);
+				}
+				worker.amaf[color(myturn)] |= bitboard::bit(nodes.fromWhichMove[next]);
 			}
+			update(nodes, node, iswin, n, worker, myturn, virtualloss);
 			return iswin;
 		}
 
 	private:
-		int sims_count = 0;
-		std::vector<int> traverseHistory;
-		Node* root;
+		std::vector<Worker> workers;
+		parallelization parallel;
+		size_t capacity, edge_capacity; // the nodes and the edges of all trees
+		std::vector<std::unique_ptr<Arena>> trees;
+		std::unique_ptr<Arena> spare; // the arena to which a promoted subtree is moved
+		std::vector<node_id> origin; // the original ids of the nodes moved to the spare arena
+		std::vector<node_id> remap; // the new ids of the original nodes moved to the spare arena
+		static constexpr node_id root = 0;
+		static constexpr int expansion = 2; // the visits of a leaf before it is expanded
+		board rootposition;
+		Leaf leaf;
+		std::atomic<bool> halt{false}; // stop the current search
+		std::atomic<bool> warned{false}; // the arena has been full
+		std::thread ponderer; // the background search during the turn of the opponent
 		std::vector<action::place> blackspace;
 		std::vector<action::place> whitespace;
 		board::piece_type who;
 		std::default_random_engine engine;
+		bool verbose = false;
 	};
 
 
@@ -331,7 +808,8 @@ class Mcts {
 class player : public random_agent {
 public:
 	player(const std::string& args = "") : random_agent("name=random role=unknown " + args),
-		space(board::size_x * board::size_y), who(board::empty), mcts() {
+		space(board::size_x * board::size_y), who(board::empty),
+		timer(meta.find("time") != meta.end() ? double(meta["time"]) : 250) {
 		if (name().find_first_of("[]():; ") != std::string::npos)
 			throw std::invalid_argument("invalid name: " + name());
 		if (role() == "black") who = board::black;
@@ -340,13 +818,49 @@ public:
 			throw std::invalid_argument("invalid role: " + role());
 		for (size_t i = 0; i < space.size(); i++)
 			space[i] = action::place(i, who);
-		mcts.setWho(who);
+		if (meta.find("type") == meta.end() || std::string(meta["type"]) != "mcts") return;
+		size_t nodes = meta.find("nodes") != meta.end() ? size_t(meta["nodes"]) : size_t(1) << 20;
+		mcts.reset(new Mcts(nodes, meta.find("edges") != meta.end() ? size_t(meta["edges"]) : nodes * 8,
+		                   meta.find("threads") != meta.end() ? size_t(meta["threads"]) : 1,
+		                   Mcts::parse_parallelization(meta.find("parallel") != meta.end() ? std::string(meta["parallel"]) : "tree")));
+		mcts->setWho(who);
+		mcts->setVerbose(meta.find("verbose") != meta.end());
+		if (meta.find("seed") != meta.end())
+			mcts->seed(uint64_t(meta["seed"]));
+	}
+	virtual void seed(uint64_t s) {
+		random_agent::seed(s);
+		if (mcts) mcts->seed(s);
+		for (size_t i = 0; i < space.size(); i++) // which is shuffled in place by randomAction
+			space[i] = action::place(i, who);
 	}
 	virtual void open_episode(const std::string& flag = "") {
-        mcts.mctsopen_episode(flag);
+        if (mcts) mcts->mctsopen_episode(flag);
     }
+	virtual void close_episode(const std::string& flag = "") {
+		if (mcts) mcts->stop_ponder();
+		timer.reset(); // the clock of the next game, which may be corrected by time_left before it opens
+	}
+
+	/**
+	 * accept the time control from GTP, as "time_settings=main_time byo_yomi_time byo_yomi_stones"
+	 * and "time_left=time stones"
+	 */
+	virtual void notify(const std::string& msg) {
+		std::string key = msg.substr(0, msg.find('='));
+		std::stringstream ss(msg.substr(msg.find('=') + 1));
+		double time = 0, byo = 0;
+		unsigned stones = 0;
+		if (key == "time_settings" && ss >> time >> byo >> stones) {
+			timer.settings(time, byo, stones);
+		} else if (key == "time_left" && ss >> time >> stones) {
+			timer.left(time, stones);
+		} else {
+			random_agent::notify(msg);
+		}
+	}
 	virtual action take_action(const board& state) {
-		if (std::string(meta["type"]) == "mcts") {
+		if (mcts) {
 		    return mctsAction(state);
 		} else {
 		    return randomAction(state);
@@ -355,25 +869,44 @@ public:
 
 	action randomAction(const board& state) {
         std::shuffle(space.begin(), space.end(), engine);
+        bitboard::mask legal = state.legal_moves(who);
         for (const action::place& move : space) {
-            board after = state;
-            if (move.apply(after) == board::legal)
+            if (legal & bitboard::bit(move.position().i))
                 return move;
         }
         return action();
 	}
 
+	/**
+	 * observe the position after the move of the opponent, which keeps the pondering on the matching subtree
+	 */
+	void observe(const board& state) {
+		if (mcts) mcts->adopt(state);
+	}
+
 	action mctsAction(const board& state) {
-	    mcts.setRoot(state);
-	    mcts.mcts_simulate();
-	    action::place move = mcts.bestaction();
-	    mcts.del_tree();
+	    bool reuse = meta.find("reuse") == meta.end() || int(meta["reuse"]); // keep the subtree for the next move
+	    if (!reuse || !mcts->advance(state))
+	        mcts->setRoot(state);
+	    bool fixed = meta.find("simulations") != meta.end(); // search a fixed number of simulations instead of the time
+	    auto deadline = timer.start(bitboard::count(state.bits().empty()));
+	    if (fixed) mcts->mcts_simulate(size_t(meta["simulations"]));
+	    else mcts->mcts_simulate(deadline);
+	    action::place move = mcts->bestaction();
+	    if (!reuse) mcts->del_tree();
+	    double elapsed = timer.stop();
+	    board after = state;
+	    if (reuse && !fixed && meta.find("ponder") != meta.end() && move.apply(after) == board::legal)
+	        mcts->ponder(move); // think on the turn of the opponent, until observe or the next search
+	    if (meta.find("verbose") != meta.end())
+	        std::cerr << "time = " << elapsed << ", left = " << timer.remaining() << std::endl;
 	    return move;
 	}
 
 private:
 	std::vector<action::place> space;
 	board::piece_type who;
-	Mcts mcts;
+	std::unique_ptr<Mcts> mcts; // the search of type=mcts, whose arenas are built by its first search
+	time_manager timer;
 };
 
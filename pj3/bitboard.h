@@ -0,0 +1,239 @@
+/**
+ * Framework for NoGo and similar games (C++ 11)
+ * bitboard.h: Define the bit-packed board of the game of NoGo with incremental liberty tracking
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+
+/**
+ * bit-packed board for 9x9 Hollow NoGo, 1 bit per point in a 128-bit mask per color
+ *
+ * the point with 1-d index (i) is stored at bit (i), where i = x * 9 + y as in board,
+ * i.e., moving right (x + 1) is a shift by 9, and moving up (y + 1) is a shift by 1
+ *
+ * besides the stones, every block (a connected group of stones) is tracked incrementally:
+ * each stone knows the id of its block, and each block knows its stones and its liberties,
+ * so that the legality of a move can be checked in constant time without any allocation
+ * note that there is no capture in NoGo, hence blocks are only created and merged
+ *
+ * the stones of the blocks with exactly one liberty (atari) and with two or more liberties (safe)
+ * are also kept per color, from which the legal moves of a color are derived by a few bit operations
+ *
+ * a Zobrist key of the stones is also kept incrementally, i.e., the xor of a random number per point per color
+ */
+class bitboard {
+public:
+	typedef unsigned __int128 mask;
+	enum size { size_x = 9u, size_y = 9u, size_xy = size_x * size_y };
+
+	static constexpr mask bit(unsigned i) { return mask(1) << i; }
+
+	/**
+	 * all the 81 points of the board
+	 */
+	static constexpr mask board_mask() { return (mask(1) << size_xy) - 1; }
+
+	/**
+	 * the hollow points at the center of the board, which are neither empty nor counted as liberty
+	 * they are the same as those set by board::init_initial_scheme
+	 */
+	static constexpr mask hollow_mask() {
+		return bit(4 * size_y + 1) | bit(4 * size_y + 2) | bit(4 * size_y + 6) | bit(4 * size_y + 7)
+		     | bit(1 * size_y + 4) | bit(2 * size_y + 4) | bit(6 * size_y + 4) | bit(7 * size_y + 4);
+	}
+
+	/**
+	 * the points at the bottom (y == 0) and the top (y == 8) of every column
+	 */
+	static constexpr mask bottom_mask() { return column_mask(1, size_x); }
+	static constexpr mask top_mask() { return column_mask(1, size_x) << (size_y - 1); }
+
+	/**
+	 * the points adjacent to any point in m, on the board (including the hollow points)
+	 */
+	static constexpr mask neighbors(mask m) {
+		return ((m << size_y) | (m >> size_y) | ((m & ~top_mask()) << 1) | ((m & ~bottom_mask()) >> 1)) & board_mask();
+	}
+
+public:
+	bitboard() : color{0, 0, 0}, atari{0, 0, 0}, safe{0, 0, 0}, id(), block(), liberty(), hash(0) {}
+	bitboard(const bitboard& b) = default;
+	bitboard& operator =(const bitboard& b) = default;
+
+	/**
+	 * the stones of black (1) or white (2)
+	 */
+	mask stones(unsigned who) const { return color[who & 0b11]; }
+	mask empty() const { return board_mask() & ~(color[1] | color[2] | hollow_mask()); }
+
+	/**
+	 * the piece at point i, i.e., empty (0), black (1), white (2), or hollow (3)
+	 */
+	unsigned at(unsigned i) const {
+		mask b = bit(i);
+		if (color[1] & b) return 1;
+		if (color[2] & b) return 2;
+		return (hollow_mask() & b) ? 3 : 0;
+	}
+
+	/**
+	 * the stones and the liberties of the block at point i, which must be occupied by a stone
+	 */
+	mask stones_of(unsigned i) const { return block[id[i]]; }
+	mask liberties_of(unsigned i) const { return liberty[id[i]]; }
+
+	/**
+	 * the Zobrist key of the stones
+	 */
+	uint64_t key() const { return hash; }
+
+	/**
+	 * whether placing a stone of who at the empty point i leaves its own block without liberty
+	 */
+	bool suicide(unsigned i, unsigned who) const {
+		mask libs = neighbors(bit(i)) & empty();
+		for (const int* n = adjacent()[i]; *n != -1; n++)
+			if (color[who] & bit(*n)) libs |= liberty[id[*n]];
+		return (libs & ~bit(i)) == 0;
+	}
+
+	/**
+	 * whether placing a stone of who at the empty point i takes the last liberty of an opposing block
+	 */
+	bool take(unsigned i, unsigned who) const {
+		for (const int* n = adjacent()[i]; *n != -1; n++)
+			if ((color[3 - who] & bit(*n)) && liberty[id[*n]] == bit(i)) return true;
+		return false;
+	}
+
+	/**
+	 * the points where a stone of who can be placed legally, i.e., the empty points
+	 * which neither take the last liberty of an opposing block (adjacent to an opposing block in atari),
+	 * nor leave the new block without liberty (no adjacent empty point and no adjacent safe friendly block)
+	 */
+	mask legal(unsigned who) const {
+		mask space = empty();
+		return space & ~neighbors(atari[3 - who]) & (neighbors(space) | neighbors(safe[who]));
+	}
+
+	/**
+	 * place a stone of who at the empty point i without checking the legality,
+	 * merge it with the adjacent friendly blocks, and update the liberties of the adjacent blocks
+	 */
+	void put(unsigned i, unsigned who) {
+		color[who] |= bit(i);
+		hash ^= zobrist(i, who);
+
+		// merge into the largest adjacent friendly block, or create a new block with this stone
+		unsigned target = i;
+		unsigned largest = 0;
+		for (const int* n = adjacent()[i]; *n != -1; n++) {
+			if (!(color[who] & bit(*n))) continue;
+			unsigned size = count(block[id[*n]]);
+			if (size > largest) largest = size, target = id[*n];
+		}
+		if (largest == 0) {
+			block[target] = 0;
+			liberty[target] = 0;
+		}
+		id[i] = target;
+		block[target] |= bit(i);
+		liberty[target] |= neighbors(bit(i)) & empty();
+
+		for (const int* n = adjacent()[i]; *n != -1; n++) {
+			mask b = bit(*n);
+			if (color[who] & b) {
+				unsigned other = id[*n];
+				if (other == target) continue;
+				block[target] |= block[other];
+				liberty[target] |= liberty[other];
+				for (mask m = block[other]; m; m &= m - 1) id[lowest(m)] = target;
+			} else if (color[3 - who] & b) {
+				liberty[id[*n]] &= ~bit(i);
+				classify(id[*n], 3 - who);
+			}
+		}
+		liberty[target] &= ~bit(i);
+		classify(target, who);
+	}
+
+public:
+	static unsigned count(mask m) {
+		return __builtin_popcountll(uint64_t(m)) + __builtin_popcountll(uint64_t(m >> 64));
+	}
+	static unsigned lowest(mask m) {
+		return uint64_t(m) ? __builtin_ctzll(uint64_t(m)) : 64 + __builtin_ctzll(uint64_t(m >> 64));
+	}
+
+	/**
+	 * the random number of a stone of who (1 or 2) at point i, and of the side to move (index 0)
+	 */
+	static uint64_t zobrist(unsigned i, unsigned who) { return zobrists()[who & 0b11][i]; }
+	static uint64_t zobrist_turn() { return zobrists()[0][0]; }
+
+protected:
+	/**
+	 * update whether the block is in atari or safe after its liberties are changed
+	 */
+	void classify(unsigned b, unsigned who) {
+		atari[who] &= ~block[b];
+		safe[who] &= ~block[b];
+		unsigned libs = count(liberty[b]);
+		if (libs == 1) atari[who] |= block[b];
+		else if (libs > 1) safe[who] |= block[b];
+	}
+
+	static constexpr mask column_mask(unsigned x, unsigned n) {
+		return n ? (column_mask(x, n - 1) << size_y) | x : 0;
+	}
+
+	/**
+	 * the adjacent points (left, right, down, up) of each point on the board, terminated by -1
+	 */
+	static const int (&adjacent())[size_xy][5] {
+		static int adj[size_xy][5];
+		return adj;
+	}
+	static __attribute__((constructor)) void init_adjacent() {
+		int (&adj)[size_xy][5] = const_cast<int (&)[size_xy][5]>(adjacent());
+		for (int i = 0; i < int(size_xy); i++) {
+			int x = i / size_y, y = i % size_y, k = 0;
+			if (x > 0) adj[i][k++] = i - size_y;
+			if (x < int(size_x) - 1) adj[i][k++] = i + size_y;
+			if (y > 0) adj[i][k++] = i - 1;
+			if (y < int(size_y) - 1) adj[i][k++] = i + 1;
+			adj[i][k] = -1;
+		}
+	}
+
+	static const uint64_t (&zobrists())[3][size_xy] {
+		static uint64_t z[3][size_xy];
+		return z;
+	}
+	static __attribute__((constructor)) void init_zobrists() {
+		uint64_t (&z)[3][size_xy] = const_cast<uint64_t (&)[3][size_xy]>(zobrists());
+		uint64_t seed = 0;
+		for (unsigned who = 0; who < 3; who++) {
+			for (unsigned i = 0; i < size_xy; i++) { // splitmix64, with a fixed seed so that the keys are reproducible
+				uint64_t x = (seed += 0x9e3779b97f4a7c15ull);
+				x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+				x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+				z[who][i] = x ^ (x >> 31);
+			}
+		}
+	}
+
+private:
+	mask color[3]; // the stones of black (1) and white (2), color[0] is unused
+	mask atari[3]; // the stones of the blocks with exactly one liberty, of each color
+	mask safe[3]; // the stones of the blocks with two or more liberties, of each color
+	uint8_t id[size_xy]; // the block id of each stone
+	mask block[size_xy]; // the stones of each block, indexed by the block id
+	mask liberty[size_xy]; // the liberties of each block, indexed by the block id
+	uint64_t hash; // the Zobrist key of the stones
+};
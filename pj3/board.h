@@ -9,12 +9,12 @@
 
 #pragma once
 #include <array>
-#include <list>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <utility>
 #include <cmath>
+#include "bitboard.h"
 
 /**
  * definition for the 9x9 board
@@ -41,6 +41,10 @@
  *
  * for 9x9 Hollow NoGo, the empty locations are hollow but not empty, cannot be counted as liberty,
  * i.e., there are also borders at the center of the board
+ *
+ * the stones are also kept in a bitboard with incrementally tracked blocks and liberties,
+ * which is used by place to check the legality; the bitboard is rebuilt from the grid
+ * if the grid may have been modified directly through the non-const accessors
  */
 class board {
 public:
@@ -56,8 +60,8 @@ public:
 	typedef int reward;
 
 public:
-	board() : stone(initial()), attr({piece_type::black}) {}
-	board(const grid& b, const data& d) : stone(b), attr(d) {}
+	board() : stone(initial()), attr({piece_type::black}), synced(true) {}
+	board(const grid& b, const data& d) : stone(b), attr(d), synced(false) {}
 	board(const board& b) = default;
 	board& operator =(const board& b) = default;
 
@@ -77,15 +81,25 @@ public:
 		}
 	};
 
-	operator grid&() { return stone; }
+	operator grid&() { synced = false; return stone; }
 	operator const grid&() const { return stone; }
-	column& operator [](unsigned x) { return stone[x]; }
+	column& operator [](unsigned x) { synced = false; return stone[x]; }
 	const column& operator [](unsigned x) const { return stone[x]; }
-	cell& operator ()(unsigned i) { point p(i); return stone[p.x][p.y]; }
+	cell& operator ()(unsigned i) { synced = false; point p(i); return stone[p.x][p.y]; }
 	const cell& operator ()(unsigned i) const { point p(i); return stone[p.x][p.y]; }
-	cell& operator ()(const std::string& move) { point p(move); return stone[p.x][p.y]; }
+	cell& operator ()(const std::string& move) { synced = false; point p(move); return stone[p.x][p.y]; }
 	const cell& operator ()(const std::string& move) const { point p(move); return stone[p.x][p.y]; }
 
+	/**
+	 * the bitboard of the stones, which is rebuilt from the grid if necessary
+	 */
+	const bitboard& bits() const { if (!synced) sync(); return packed; }
+
+	/**
+	 * the Zobrist hash of the position, i.e., the key of the stones and the side to move
+	 */
+	uint64_t hash() const { return bits().key() ^ (attr.who_take_turns == piece_type::white ? bitboard::zobrist_turn() : 0); }
+
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
 
@@ -120,17 +134,14 @@ public:
 		point p_min(0, 0), p_max(size_x - 1, size_y - 1);
 		if (x < p_min.x || x > p_max.x || y < p_min.y || y > p_max.y) return nogo_move_result::illegal_out_of_range;
 		if (board::initial()[x][y] == piece_type::hollow)             return nogo_move_result::illegal_out_of_range;
-		board test = *this;
-		if (test[x][y] != piece_type::empty) return nogo_move_result::illegal_not_empty;
-		test[x][y] = who; // try put a piece first
-		if (test.check_liberty(x, y, who) == 0) return nogo_move_result::illegal_suicide;
-		unsigned opp = 3u - who;
-		if (x > p_min.x && test.check_liberty(x - 1, y, opp) == 0) return nogo_move_result::illegal_take;
-		if (x < p_max.x && test.check_liberty(x + 1, y, opp) == 0) return nogo_move_result::illegal_take;
-		if (y > p_min.y && test.check_liberty(x, y - 1, opp) == 0) return nogo_move_result::illegal_take;
-		if (y < p_max.y && test.check_liberty(x, y + 1, opp) == 0) return nogo_move_result::illegal_take;
+		const bitboard& test = bits();
+		unsigned i = point(x, y).i;
+		if (stone[x][y] != piece_type::empty) return nogo_move_result::illegal_not_empty;
+		if (test.suicide(i, who)) return nogo_move_result::illegal_suicide;
+		if (test.take(i, who)) return nogo_move_result::illegal_take;
+		packed.put(i, who);
 		stone[x][y] = who; // is legal move!
-		attr.who_take_turns = static_cast<piece_type>(opp);
+		attr.who_take_turns = static_cast<piece_type>(3u - who);
 		return nogo_move_result::legal;
 	}
 	reward place(const point& p, unsigned who = piece_type::unknown) {
@@ -138,41 +149,27 @@ public:
 	}
 
 	/**
-	 * calculate the liberty of the block of piece at [x][y]
+	 * the points (1-d index as bits) where who can place a stone legally,
+	 * i.e., bit (i) is set iff place(i, who) returns nogo_move_result::legal
+	 * who == piece_type::unknown indicates the next side
+	 */
+	bitboard::mask legal_moves(unsigned who = piece_type::unknown) const {
+		if (who == -1u) who = attr.who_take_turns;
+		if (who != attr.who_take_turns) return 0;
+		return bits().legal(who);
+	}
+
+	/**
+	 * calculate the liberty of the block of piece at [x][y], i.e., the number of distinct empty points adjacent to it
 	 * return >= 0 if [x][y] is placed by who; otherwise return -1
 	 */
 	int check_liberty(int x, int y, unsigned who) const {
-		grid test = stone;
-		if (test[x][y] != who) return -1;
-
-		int liberty = 0;
-		std::list<point> check;
-		for (check.emplace_back(x, y); check.size(); check.pop_front()) {
-			int x = check.front().x, y = check.front().y;
-			test[x][y] = piece_type::unknown; // prevent recalculate
-
-			point p_min(0, 0), p_max(size_x - 1, size_y - 1);
-
-			cell near_l = x > p_min.x ? test[x - 1][y] : -1u; // left
-			if (near_l == piece_type::empty) liberty++;
-			else if (near_l == who) check.emplace_back(x - 1, y);
-
-			cell near_r = x < p_max.x ? test[x + 1][y] : -1u; // right
-			if (near_r == piece_type::empty) liberty++;
-			else if (near_r == who) check.emplace_back(x + 1, y);
-
-			cell near_d = y > p_min.y ? test[x][y - 1] : -1u; // down
-			if (near_d == piece_type::empty) liberty++;
-			else if (near_d == who) check.emplace_back(x, y - 1);
-
-			cell near_u = y < p_max.y ? test[x][y + 1] : -1u; // up
-			if (near_u == piece_type::empty) liberty++;
-			else if (near_u == who) check.emplace_back(x, y + 1);
-		}
-		return liberty;
+		if (stone[x][y] != who) return -1;
+		return bitboard::count(bits().liberties_of(point(x, y).i));
 	}
 
 	void transpose() {
+		synced = false;
 		for (int x = 0; x < size_x; x++) {
 			for (int y = x + 1; y < size_y; y++) {
 				std::swap(stone[x][y], stone[y][x]);
@@ -181,6 +178,7 @@ public:
 	}
 
 	void reflect_horizontal() {
+		synced = false;
 		for (int y = 0; y < size_y; y++) {
 			for (int x = 0; x < size_x / 2; x++) {
 				std::swap(stone[x][y], stone[size_x - 1 - x][y]);
@@ -189,6 +187,7 @@ public:
 	}
 
 	void reflect_vertical() {
+		synced = false;
 		for (int x = 0; x < size_x; x++) {
 			for (int y = 0; y < size_y / 2; y++) {
 				std::swap(stone[x][y], stone[x][size_y - 1 - y]);
@@ -286,7 +285,21 @@ protected:
 		stone[6][4] = piece_type::hollow;
 		stone[7][4] = piece_type::hollow;
 	}
+
+	/**
+	 * rebuild the bitboard from the grid
+	 */
+	void sync() const {
+		packed = {};
+		for (unsigned i = 0; i < size_x * size_y; i++) {
+			cell c = stone[i / size_y][i % size_y];
+			if (c == piece_type::black || c == piece_type::white) packed.put(i, c);
+		}
+		synced = true;
+	}
 private:
 	grid stone;
 	data attr;
+	mutable bitboard packed;
+	mutable bool synced;
 };
@@ -11,6 +11,10 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <thread>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
@@ -22,7 +26,7 @@ int main(int argc, const char* argv[]) {
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
-	size_t total = 1000, block = 0, limit = 0;
+	size_t total = 1000, block = 0, limit = 0, threads = 1;
 	std::string black_args, white_args;
 	std::string load_path, save_path;
 	std::string name = "TCG-HollowNoGo-Demo", version = "2022"; // for GTP shell
@@ -55,6 +59,8 @@ int main(int argc, const char* argv[]) {
 			name = next_opt();
 		} else if (match_arg("version")) {
 			version = next_opt();
+		} else if (match_arg("threads")) {
+			threads = std::max(std::stoull(next_opt()), 1ull);
 		} else if (match_arg("shell")) {
 			shell = true;
 		}
@@ -72,14 +78,25 @@ int main(int argc, const char* argv[]) {
 	player black("name=black " + black_args + " role=black");
 	player white("name=white " + white_args + " role=white");
 
-	if (!shell) { // launch standard local games
-		while (!stats.is_finished()) {
-//			std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
+	auto seed_of = [](const std::string& args) -> uint64_t {
+		std::stringstream ss(args);
+		uint64_t seed = 1; // the default seed of std::default_random_engine
+		for (std::string pair; ss >> pair; )
+			if (pair.substr(0, pair.find('=')) == "seed") seed = std::stoull(pair.substr(pair.find('=') + 1));
+		return seed;
+	};
+	uint64_t black_seed = seed_of(black_args), white_seed = seed_of(white_args);
+
+	auto play = [&](player& black, player& white) {
+		for (size_t index; stats.claim_episode(index); ) {
+//			std::cerr << "======== Game " << index << " ========" << std::endl;
+			black.seed(black_seed + index); // each game is seeded by its index, whichever worker plays it
+			white.seed(white_seed + index);
 			black.open_episode("~:" + white.name());
 			white.open_episode(black.name() + ":~");
 
-			stats.open_episode(black.name() + ":" + white.name());
-			episode& game = stats.back();
+			episode game;
+			game.open_episode(black.name() + ":" + white.name());
 			while (true) {
 				agent& who = game.take_turns(black, white);
 				action move = who.take_action(game.state());
@@ -88,11 +105,27 @@ int main(int argc, const char* argv[]) {
 				if (who.check_for_win(game.state())) break;
 			}
 			agent& win = game.last_turns(black, white);
-			stats.close_episode(win.name());
+			game.close_episode(win.name());
+			stats.commit_episode(index, std::move(game));
 
 			black.close_episode(win.name());
 			white.close_episode(win.name());
 		}
+	};
+
+	if (!shell && threads > 1) { // each worker plays its own games with its own players
+		std::vector<std::unique_ptr<player>> blacks, whites;
+		for (size_t i = 1; i < threads; i++) {
+			blacks.emplace_back(new player("name=black " + black_args + " role=black"));
+			whites.emplace_back(new player("name=white " + white_args + " role=white"));
+		}
+		std::vector<std::thread> workers;
+		for (size_t i = 1; i < threads; i++)
+			workers.emplace_back(play, std::ref(*blacks[i - 1]), std::ref(*whites[i - 1]));
+		play(black, white);
+		for (std::thread& worker : workers) worker.join();
+	} else if (!shell) { // launch standard local games
+		play(black, white);
 	} else { // launch GTP shell
 		for (std::string command; std::getline(std::cin, command); ) {
 			if (command.back() == '\r') command.pop_back();
@@ -143,6 +176,8 @@ int main(int argc, const char* argv[]) {
 						std::cerr << "reason: " << reason[std::min(-code, 7)] << std::endl;
 						break;
 					}
+					player& other = (&who == &black) ? white : black;
+					other.observe(game.state()); // the opponent may be pondering on this move
 				} else if (args[0] == "genmove") { // generate a move and play
 					action::place move = who.take_action(game.state());
 					if (game.apply_action(move) == true) {
@@ -174,6 +209,13 @@ int main(int argc, const char* argv[]) {
 				}
 				if (size > board::size_x || size > board::size_y) break;
 
+			} else if (args[0] == "time_settings" && args.size() >= 4) { // set the time control of both players
+				black.notify("time_settings=" + args[1] + " " + args[2] + " " + args[3]);
+				white.notify("time_settings=" + args[1] + " " + args[2] + " " + args[3]);
+			} else if (args[0] == "time_left" && args.size() >= 4) { // update the remaining time of a player
+				player& who = (std::tolower(args[1][0]) == 'b') ? black : white;
+				who.notify("time_left=" + args[2] + " " + args[3]);
+
 			} else if (args[0] == "name") { // report the name of the program
 				reply = name;
 			} else if (args[0] == "version") { // report the version number of the program
@@ -182,7 +224,7 @@ int main(int argc, const char* argv[]) {
 				reply = "2";
 			} else if (args[0] == "list_commands") { // print supported commands
 				reply = "play\n" "genmove\n" "clear_board\n" "showboard\n" "boardsize\n"
-				        "name\n" "version\n" "protocol_version\n" "list_commands\n" "quit\n";
+				        "time_settings\n" "time_left\n" "name\n" "version\n" "protocol_version\n" "list_commands\n" "quit\n";
 			} else {
 				reply = "unknown command";
 			}
@@ -0,0 +1,106 @@
+/**
+ * Framework for NoGo and similar games (C++ 11)
+ * rollout.h: Fast random playouts for the Monte-Carlo tree search of NoGo
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "board.h"
+#include "bitboard.h"
+
+/**
+ * xorshift64* generator, which also meets the requirements of UniformRandomBitGenerator
+ */
+class xorshift {
+public:
+	typedef uint64_t result_type;
+	explicit xorshift(uint64_t seed = 0) { this->seed(seed); }
+	void seed(uint64_t seed) { state = seed ? seed : 0x9e3779b97f4a7c15ull; }
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+	result_type operator ()() {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545f4914f6cdd1dull;
+	}
+
+	/**
+	 * a uniform integer in [0, n), by the multiply-shift method
+	 */
+	unsigned below(unsigned n) { return unsigned((uint64_t(uint32_t(operator()() >> 32)) * n) >> 32); }
+
+private:
+	uint64_t state;
+};
+
+/**
+ * random playouts on the bitboard
+ *
+ * each color keeps a list of candidate points, which are drawn uniformly and removed by swapping
+ * with the last one; a drawn point is played if it is legal, or is dropped otherwise
+ * this is exact for NoGo, since an illegal point never becomes legal again: the neighbors of a point
+ * are only filled, and a block can only gain liberties by a stone placed next to it
+ * hence the side to move loses once its list is exhausted
+ *
+ * the points played by each color in the last playout are kept for the all-moves-as-first (AMAF) statistics
+ */
+class rollout {
+public:
+	rollout(uint64_t seed = 0) : rng(seed), played(0), record{0, 0, 0} {}
+
+	void seed(uint64_t seed) { rng.seed(seed); }
+
+	/**
+	 * play randomly from the state with who to move, until the side to move has no legal move
+	 * return the winner, i.e., the side who makes the last move
+	 */
+	unsigned run(const board& state, unsigned who) {
+		bitboard b = state.bits();
+		uint8_t cand[3][bitboard::size_xy];
+		unsigned size[3] = { 0, 0, 0 };
+		record[board::black] = record[board::white] = 0;
+		for (unsigned c = board::black; c <= board::white; c++)
+			for (bitboard::mask m = b.legal(c); m; m &= m - 1) cand[c][size[c]++] = bitboard::lowest(m);
+
+		for (;; who = 3 - who) {
+			uint8_t* list = cand[who];
+			unsigned& n = size[who];
+			bool moved = false;
+			while (n && !moved) {
+				unsigned k = rng.below(n);
+				unsigned i = list[k];
+				list[k] = list[--n];
+				if ((b.empty() & bitboard::bit(i)) && !b.suicide(i, who) && !b.take(i, who)) {
+					b.put(i, who);
+					record[who] |= bitboard::bit(i);
+					moved = true;
+				}
+			}
+			if (!moved) break;
+		}
+		played++;
+		return 3 - who;
+	}
+
+	/**
+	 * the number of playouts since the engine is constructed
+	 */
+	size_t playouts() const { return played; }
+
+	/**
+	 * the points played by black (1) or white (2) in the last playout
+	 */
+	bitboard::mask moves(unsigned who) const { return record[who]; }
+
+private:
+	xorshift rng;
+	size_t played;
+	bitboard::mask record[3];
+};
@@ -12,6 +12,8 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <map>
+#include <mutex>
 #include "board.h"
 #include "action.h"
 #include "episode.h"
@@ -29,7 +31,8 @@ public:
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  claimed(0) {}
 
 public:
 	/**
@@ -101,6 +104,33 @@ public:
 		if (count % block == 0) show();
 	}
 
+	/**
+	 * claim the next episode to play, and get its index; return false if no more episode is needed
+	 * this and commit_episode are thread-safe, so that parallel game runners can
+	 * play their own episodes and commit the finished ones here
+	 */
+	bool claim_episode(size_t& index) {
+		std::lock_guard<std::mutex> lock(guard);
+		if (std::max(count, claimed) >= total) return false;
+		index = claimed = std::max(count, claimed) + 1;
+		return true;
+	}
+
+	/**
+	 * commit a finished episode which is previously claimed by claim_episode
+	 * the episodes are recorded in the order of their indices, i.e., an episode which is finished early
+	 * waits for the earlier ones, so that the records do not depend on the scheduling of the runners
+	 */
+	void commit_episode(size_t index, episode&& ep) {
+		std::lock_guard<std::mutex> lock(guard);
+		waiting.emplace(index, std::move(ep));
+		for (auto it = waiting.begin(); it != waiting.end() && it->first == count + 1; it = waiting.erase(it)) {
+			if (count++ >= limit) data.pop_front();
+			data.push_back(std::move(it->second));
+			if (count % block == 0) show();
+		}
+	}
+
 	episode& at(size_t i) {
 		return data.at(i);
 	}
@@ -133,5 +163,8 @@ private:
 	size_t block;
 	size_t limit;
 	size_t count;
+	size_t claimed; // the index of the last claimed episode
 	std::deque<episode> data;
+	std::map<size_t, episode> waiting; // the committed episodes waiting for the earlier ones
+	std::mutex guard;
 };
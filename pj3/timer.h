@@ -0,0 +1,120 @@
+/**
+ * Framework for NoGo and similar games (C++ 11)
+ * timer.h: Manage the thinking time of a player over a game
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <chrono>
+#include <algorithm>
+
+/**
+ * the time control of a game, i.e., main time followed by Canadian byo-yomi as in GTP time_settings,
+ * where a period of byo_time seconds is given for every byo_stones moves after the main time is used up
+ *
+ * the clock of the player is kept by its own measure of the thinking time, and can be corrected
+ * by GTP time_left, which reports the remaining main time, or the remaining period and stones
+ *
+ * the budget of a move is the remaining time divided by the number of moves still to be played,
+ * which is estimated from the number of empty points, since a NoGo game rarely fills the board
+ */
+class time_manager {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	time_manager(double main = 250, double byo = 0, unsigned stones = 0) : game_time(main) { settings(main, byo, stones); }
+
+	/**
+	 * set the time control, and reset the clock for a new game
+	 * byo_yomi_time > 0 with byo_yomi_stones == 0 means no time limit, as defined by GTP,
+	 * in which case the moves are budgeted by the main time given at construction instead
+	 */
+	void settings(double main, double byo = 0, unsigned stones = 0) {
+		main_time = main;
+		byo_time = byo;
+		byo_stones = stones;
+		reset();
+	}
+	void reset() {
+		main_left = main_time;
+		period_left = byo_time;
+		period_stones = 0;
+	}
+
+	/**
+	 * update the remaining time reported by the controller, where stones == 0 means the main time
+	 */
+	void left(double time, unsigned stones = 0) {
+		if (stones == 0) {
+			main_left = time;
+		} else {
+			main_left = 0;
+			period_left = time;
+			period_stones = stones;
+		}
+	}
+
+	bool unlimited() const { return byo_time > 0 && byo_stones == 0; }
+
+	/**
+	 * the thinking time (in seconds) of the next move, given the number of empty points on the board
+	 */
+	double budget(unsigned empty) const {
+		double time;
+		if (period_stones) { // in byo-yomi
+			time = period_left / period_stones;
+		} else {
+			double moves = std::max(empty / 3.0, 4.0); // the moves of this player still to be played
+			double period = byo_stones ? byo_time / byo_stones : 0;
+			time = std::min(main_left / moves + period, main_left / 2 + period);
+		}
+		if (unlimited()) time = game_time / std::max(empty / 3.0, 4.0);
+		return std::max(time * 0.95 - margin, 0.01); // leave some time for the communication
+	}
+
+	/**
+	 * start the clock of a move, and return the deadline of its search given the number of empty points
+	 */
+	clock::time_point start(unsigned empty) {
+		started = clock::now();
+		return started + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(budget(empty)));
+	}
+
+	/**
+	 * stop the clock of a move, charge the elapsed time, and return it in seconds
+	 */
+	double stop() {
+		double elapsed = std::chrono::duration<double>(clock::now() - started).count();
+		if (unlimited()) return elapsed;
+		if (period_stones == 0) {
+			main_left -= elapsed;
+			if (main_left >= 0 || byo_stones == 0) return elapsed;
+			period_left = byo_time + main_left; // the main time is used up during this move
+			period_stones = byo_stones;
+			main_left = 0;
+		} else {
+			period_left -= elapsed;
+		}
+		if (--period_stones == 0) { // a new period begins
+			period_left = byo_time;
+			period_stones = byo_stones;
+		}
+		return elapsed;
+	}
+
+	double remaining() const { return period_stones ? period_left : main_left; }
+
+private:
+	static constexpr double margin = 0.05;
+	double game_time; // the main time of the player's own option, used when there is no time limit
+	double main_time;
+	double byo_time;
+	unsigned byo_stones;
+	double main_left;
+	double period_left;
+	unsigned period_stones;
+	clock::time_point started;
+};